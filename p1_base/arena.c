@@ -0,0 +1,146 @@
+#include "arena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "constants.h"
+#include "statemem.h"
+
+#define ARENA_ALIGNMENT CACHE_LINE_SIZE  // Allocations start on their own cache line
+
+struct ArenaChunk {
+  struct ArenaChunk* next;
+  size_t size;    /// Usable bytes after the header.
+  int dedicated;  /// Whether the chunk holds a single allocation.
+  _Alignas(ARENA_ALIGNMENT) char data[];
+};
+
+static size_t align_size(size_t size) { return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1); }
+
+static void lock_arena(struct Arena* arena) {
+  if (pthread_mutex_lock(&arena->lock)) {
+    fprintf(stderr, "Lock Error\n");
+    exit(1);
+  }
+}
+
+static void unlock_arena(struct Arena* arena) {
+  if (pthread_mutex_unlock(&arena->lock)) {
+    fprintf(stderr, "Lock Error\n");
+    exit(1);
+  }
+}
+
+/// Allocates a chunk and links it after the chunk being filled, or first if there is none.
+/// @note Must be called with the arena lock held.
+/// @return The new chunk, NULL if there is not enough memory.
+static struct ArenaChunk* add_chunk(struct Arena* arena, size_t size, int dedicated) {
+  if (size > (size_t)-1 - sizeof(struct ArenaChunk)) {
+    return NULL;
+  }
+  // state_alloc only aligns to a cache line in shared mode, malloc'd chunks are aligned by hand
+  struct ArenaChunk* chunk = NULL;
+  if (statemem_shared()) {
+    chunk = state_alloc(sizeof(struct ArenaChunk) + size);
+  }
+  else if (posix_memalign((void**)&chunk, ARENA_ALIGNMENT, sizeof(struct ArenaChunk) + size)) {
+    chunk = NULL;
+  }
+  if (chunk == NULL) {
+    return NULL;
+  }
+  chunk->size = size;
+  chunk->dedicated = dedicated;
+  if (arena->chunks == NULL) {
+    chunk->next = NULL;
+    arena->chunks = chunk;
+  }
+  else {
+    chunk->next = arena->chunks->next;
+    arena->chunks->next = chunk;
+  }
+  return chunk;
+}
+
+int arena_init(struct Arena* arena) {
+  arena->chunks = NULL;
+  arena->next = NULL;
+  arena->left = 0;
+  arena->last = NULL;
+  return state_mutex_init(&arena->lock);
+}
+
+void arena_destroy(struct Arena* arena) {
+  struct ArenaChunk* chunk = arena->chunks;
+  while (chunk != NULL) {
+    struct ArenaChunk* next = chunk->next;
+    state_free(chunk);
+    chunk = next;
+  }
+  arena->chunks = NULL;
+  if (pthread_mutex_destroy(&arena->lock)) {
+    fprintf(stderr, "Lock Error\n");
+    exit(1);
+  }
+}
+
+void* arena_alloc(struct Arena* arena, size_t size) {
+  if (size > (size_t)-1 - ARENA_ALIGNMENT) {
+    return NULL;
+  }
+  size = align_size(size > 0 ? size : 1);
+
+  lock_arena(arena);
+  void* ptr = NULL;
+  if (size <= arena->left) {
+    ptr = arena->next;
+  }
+  else if (size <= ARENA_CHUNK_SIZE / 4) {
+    // The rest of the current chunk is abandoned, it's never more than a quarter of it
+    struct ArenaChunk* chunk = add_chunk(arena, ARENA_CHUNK_SIZE, 0);
+    if (chunk != NULL) {
+      // The new chunk goes first, so it's the one being filled
+      if (arena->chunks != chunk) {
+        arena->chunks->next = chunk->next;
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+      }
+      arena->next = chunk->data;
+      arena->left = chunk->size;
+      ptr = arena->next;
+    }
+  }
+  else {
+    struct ArenaChunk* chunk = add_chunk(arena, size, 1);
+    unlock_arena(arena);
+    return chunk != NULL ? chunk->data : NULL;
+  }
+
+  if (ptr != NULL) {
+    arena->next += size;
+    arena->left -= size;
+    arena->last = ptr;
+  }
+  unlock_arena(arena);
+  return ptr;
+}
+
+void arena_free(struct Arena* arena, void* ptr) {
+  lock_arena(arena);
+  if (ptr == arena->last) {
+    arena->left += (size_t)(arena->next - (char*)ptr);
+    arena->next = ptr;
+    arena->last = NULL;
+  }
+  else {
+    for (struct ArenaChunk** link = &arena->chunks; *link != NULL; link = &(*link)->next) {
+      struct ArenaChunk* chunk = *link;
+      if (chunk->dedicated && chunk->data == ptr) {
+        *link = chunk->next;
+        state_free(chunk);
+        break;
+      }
+    }
+  }
+  unlock_arena(arena);
+}
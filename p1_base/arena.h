@@ -0,0 +1,44 @@
+#ifndef EMS_ARENA_H
+#define EMS_ARENA_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+// Bump allocator for objects that live as long as the structure owning the arena. Memory is taken
+// from the EMS state (see statemem.h) in chunks of ARENA_CHUNK_SIZE bytes and only given back all at
+// once, when the arena is destroyed, so destroying it costs one free per chunk rather than per object.
+
+struct ArenaChunk;
+
+struct Arena {
+  struct ArenaChunk* chunks;  /// Every chunk of the arena, the one being filled first.
+  char* next;                 /// Next free byte of the chunk being filled.
+  size_t left;                /// Free bytes left in it.
+  void* last;                 /// Latest allocation from the chunk, the only one arena_free can take back.
+  pthread_mutex_t lock;
+};
+
+/// Initializes an empty arena.
+/// @param arena Arena to be initialized, stored in the EMS state.
+/// @return 0 if the arena was initialized successfully, 1 otherwise.
+int arena_init(struct Arena* arena);
+
+/// Frees every allocation of an arena, and the arena itself.
+void arena_destroy(struct Arena* arena);
+
+/// Allocates memory from an arena.
+/// @note Allocations start on their own cache line. Allocations larger than a quarter of a chunk get a
+/// chunk of their own.
+/// @param arena Arena to allocate from.
+/// @param size Number of bytes.
+/// @return Pointer to the memory, NULL if there is not enough.
+void* arena_alloc(struct Arena* arena, size_t size);
+
+/// Gives back an allocation before the arena is destroyed, if possible.
+/// @note Only allocations with a chunk of their own and the latest one from the shared chunk are
+/// given back, the others stay allocated until arena_destroy.
+/// @param arena Arena the memory was allocated from.
+/// @param ptr Pointer returned by arena_alloc.
+void arena_free(struct Arena* arena, void* ptr);
+
+#endif  // EMS_ARENA_H
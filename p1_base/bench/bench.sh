@@ -0,0 +1,79 @@
+#!/bin/bash
+# Runs ems over generated workloads for every combination of max_proc, max_thr and delay, and reports
+# the throughput of each run and the percentiles of the time each jobs file took to complete (from the
+# start of the run to the last write of its .out file).
+#
+# Settings, from the environment:
+#   EMS            binary to run (./ems)
+#   EMS_FLAGS      extra options passed to ems, e.g. "-p", "-l bit", "-q 8" or "-c 64" (none)
+#   BENCH_PROCS    values of max_proc ("1 4")
+#   BENCH_THREADS  values of max_thr ("1 4")
+#   BENCH_DELAYS   state access delays in ms, or in us with a "us" suffix ("1")
+#   BENCH_FILES    jobs files per workload (8)
+#   BENCH_COMMANDS commands per jobs file (200)
+#   BENCH_REPS     runs per combination (3)
+#   BENCH_WORKLOADS  names of the workloads below to run (all of them)
+
+set -euo pipefail
+cd "$(dirname "$0")/.."
+
+EMS=${EMS:-./ems}
+JOBGEN=${JOBGEN:-./bench/jobgen}
+EMS_FLAGS=${EMS_FLAGS:-}
+BENCH_PROCS=${BENCH_PROCS:-1 4}
+BENCH_THREADS=${BENCH_THREADS:-1 4}
+BENCH_DELAYS=${BENCH_DELAYS:-1}
+BENCH_FILES=${BENCH_FILES:-8}
+BENCH_COMMANDS=${BENCH_COMMANDS:-200}
+BENCH_REPS=${BENCH_REPS:-3}
+
+# Workloads, as jobgen options
+declare -A WORKLOADS=(
+  [uniform]="-e 64 -r 10 -c 20 -s 4 -S 20"
+  [hot]="-e 64 -r 10 -c 20 -s 4 -S 20 -k 80"
+  [large]="-e 8 -r 100 -c 100 -s 32 -S 10"
+  [mixed]="-e 32 -r 10 -c 20 -s 4 -S 50 -w 5 -b 5 -d 1"
+)
+BENCH_WORKLOADS=${BENCH_WORKLOADS:-uniform hot large mixed}
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+# Prints the p-th percentile of the sorted numbers in a file
+percentile() {
+  awk -v p="$2" '{ v[NR] = $1 } END { i = int(p * NR + 0.999999); if (i < 1) i = 1; printf "%.1f", v[i] }' "$1"
+}
+
+printf "%-8s %5s %5s %6s %12s %9s %9s %9s\n" workload procs thr delay "cmds/s" "p50 ms" "p90 ms" "p99 ms"
+for workload in $BENCH_WORKLOADS; do
+  dir="$work/$workload"
+  mkdir -p "$dir"
+  for i in $(seq 1 "$BENCH_FILES"); do
+    # shellcheck disable=SC2086
+    "$JOBGEN" ${WORKLOADS[$workload]} -n "$BENCH_COMMANDS" -x "$i" > "$dir/$i.jobs"
+  done
+  commands=$(cat "$dir"/*.jobs | grep -vc '^[[:space:]]*$')
+
+  for procs in $BENCH_PROCS; do
+    for threads in $BENCH_THREADS; do
+      for delay in $BENCH_DELAYS; do
+        latencies="$work/latencies"
+        : > "$latencies"
+        total_ns=0
+        for _ in $(seq 1 "$BENCH_REPS"); do
+          rm -f "$dir"/*.out
+          start=$(date +%s%N)
+          # shellcheck disable=SC2086
+          "$EMS" $EMS_FLAGS "$dir" "$procs" "$threads" "$delay" > /dev/null 2>&1
+          end=$(date +%s%N)
+          total_ns=$((total_ns + end - start))
+          stat -c %.9Y "$dir"/*.out | awk -v start="$start" '{ printf "%.3f\n", ($1 - start / 1e9) * 1e3 }' >> "$latencies"
+        done
+        sort -n -o "$latencies" "$latencies"
+        throughput=$(awk -v c="$commands" -v r="$BENCH_REPS" -v ns="$total_ns" 'BEGIN { printf "%.0f", c * r / (ns / 1e9) }')
+        printf "%-8s %5s %5s %6s %12s %9s %9s %9s\n" "$workload" "$procs" "$threads" "$delay" "$throughput" \
+          "$(percentile "$latencies" 0.50)" "$(percentile "$latencies" 0.90)" "$(percentile "$latencies" 0.99)"
+      done
+    done
+  done
+done
@@ -0,0 +1,137 @@
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "constants.h"
+
+// Generates a synthetic jobs file: the CREATEs of every event, then a random mix of RESERVEs, SHOWs,
+// WAITs and BARRIERs, then a LIST. The same options and seed always give the same file.
+
+#define USAGE                                                                                              \
+  "Usage: jobgen [-e events] [-r rows] [-c cols] [-n commands] [-s max_seats] [-k hot_percent]\n"         \
+  "              [-S show_percent] [-w wait_permille] [-b barrier_permille] [-d wait_ms] [-x seed]\n"
+
+struct Workload {
+  unsigned int events;          /// Number of events created.
+  unsigned int rows;            /// Rows of every event.
+  unsigned int cols;            /// Columns of every event.
+  unsigned int commands;        /// Number of commands after the CREATEs.
+  unsigned int max_seats;       /// Largest number of seats of a RESERVE.
+  unsigned int hot_percent;     /// Share of the RESERVEs and SHOWs that go to event 1.
+  unsigned int show_percent;    /// Share of SHOWs among RESERVEs and SHOWs.
+  unsigned int wait_permille;   /// WAITs per thousand commands.
+  unsigned int barrier_permille;  /// BARRIERs per thousand commands.
+  unsigned int wait_ms;         /// Delay of the WAITs.
+};
+
+static uint64_t rng_state;
+
+/// Draws a random number with xorshift64*.
+/// @param bound Number of possible values.
+/// @return Number in [0, bound).
+static unsigned int next_random(unsigned int bound) {
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return (unsigned int)(((rng_state * 0x2545f4914f6cdd1dULL) >> 32) % bound);
+}
+
+/// Picks the event of a RESERVE or a SHOW.
+static unsigned int pick_event(struct Workload const* workload) {
+  if (next_random(100) < workload->hot_percent) {
+    return 1;
+  }
+  return 1 + next_random(workload->events);
+}
+
+/// Writes a RESERVE of consecutive seats in a random row.
+static void write_reserve(struct Workload const* workload) {
+  unsigned int seats = 1 + next_random(workload->max_seats);
+  unsigned int row = 1 + next_random(workload->rows);
+  unsigned int col = 1 + next_random(workload->cols - seats + 1);
+  printf("RESERVE %u [", pick_event(workload));
+  for (unsigned int i = 0; i < seats; i++) {
+    printf(i == 0 ? "(%u,%u)" : " (%u,%u)", row, col + i);
+  }
+  printf("]\n");
+}
+
+static void generate(struct Workload const* workload) {
+  for (unsigned int event = 1; event <= workload->events; event++) {
+    printf("CREATE %u %u %u\n", event, workload->rows, workload->cols);
+  }
+  for (unsigned int i = 0; i < workload->commands; i++) {
+    unsigned int draw = next_random(1000);
+    if (draw < workload->barrier_permille) {
+      printf("BARRIER\n");
+    }
+    else if (draw < workload->barrier_permille + workload->wait_permille) {
+      printf("WAIT %u\n", workload->wait_ms);
+    }
+    else if (next_random(100) < workload->show_percent) {
+      printf("SHOW %u\n", pick_event(workload));
+    }
+    else {
+      write_reserve(workload);
+    }
+  }
+  printf("LIST\n");
+}
+
+/// Parses an option value.
+/// @return 0 if the value was parsed successfully, 1 otherwise.
+static int parse_option(const char* arg, unsigned int* value) {
+  char* endptr;
+  unsigned long val = strtoul(arg, &endptr, 10);
+  if (*arg == '\0' || *endptr != '\0' || val > UINT_MAX) {
+    return 1;
+  }
+  *value = (unsigned int)val;
+  return 0;
+}
+
+int main(int argc, char* argv[]) {
+  struct Workload workload = {.events = 16, .rows = 10, .cols = 20, .commands = 1000, .max_seats = 4,
+                              .hot_percent = 0, .show_percent = 20, .wait_permille = 0, .barrier_permille = 0,
+                              .wait_ms = 1};
+  unsigned int seed = 1;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "e:r:c:n:s:k:S:w:b:d:x:")) != -1) {
+    unsigned int* value;
+    switch (opt) {
+      case 'e': value = &workload.events; break;
+      case 'r': value = &workload.rows; break;
+      case 'c': value = &workload.cols; break;
+      case 'n': value = &workload.commands; break;
+      case 's': value = &workload.max_seats; break;
+      case 'k': value = &workload.hot_percent; break;
+      case 'S': value = &workload.show_percent; break;
+      case 'w': value = &workload.wait_permille; break;
+      case 'b': value = &workload.barrier_permille; break;
+      case 'd': value = &workload.wait_ms; break;
+      case 'x': value = &seed; break;
+      default:
+        fprintf(stderr, USAGE);
+        return 1;
+    }
+    if (parse_option(optarg, value)) {
+      fprintf(stderr, USAGE);
+      return 1;
+    }
+  }
+
+  // RESERVEs stay within a row and under the default limit of ems
+  if (workload.events == 0 || workload.rows == 0 || workload.cols == 0 || workload.max_seats == 0 ||
+      workload.max_seats > workload.cols || workload.max_seats >= MAX_RESERVATION_SIZE || workload.hot_percent > 100 ||
+      workload.show_percent > 100 || workload.wait_permille + workload.barrier_permille > 1000 || optind != argc) {
+    fprintf(stderr, USAGE);
+    return 1;
+  }
+
+  rng_state = 0x9e3779b97f4a7c15ULL * ((uint64_t)seed + 1);
+  generate(&workload);
+  return 0;
+}
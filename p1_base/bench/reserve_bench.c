@@ -0,0 +1,99 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "operations.h"
+#include "seatlock.h"
+
+// Microbenchmark of concurrent RESERVEs on a single event, without the state access delay.
+// Each thread reserves the seats of its own row one at a time, so the reservations never conflict
+// and what is measured is the cost of sharing the event between the threads.
+
+#define USAGE "Usage: reserve_bench [-l seat|row|striped|bit|optimistic] [max_threads] [reservations_per_thread]\n"
+#define EVENT_ID 1
+
+struct EmsState* state;
+size_t reservations_per_thread = 200000;
+pthread_barrier_t start;
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void* reserve_row(void* arg) {
+  size_t row = (size_t)arg;
+  pthread_barrier_wait(&start);
+  for (size_t col = 1; col <= reservations_per_thread; col++) {
+    if (ems_reserve(state, EVENT_ID, 1, &row, &col)) {
+      fprintf(stderr, "Failed to reserve seats\n");
+      exit(1);
+    }
+  }
+  return NULL;
+}
+
+/// Times the reservations of a number of threads on a new event.
+/// @return Reservations per second.
+static double run(unsigned int num_threads) {
+  pthread_t threads[num_threads];
+  state = ems_state_create();
+  if (state == NULL || ems_create(state, EVENT_ID, num_threads, reservations_per_thread)) {
+    fprintf(stderr, "Failed to create event\n");
+    exit(1);
+  }
+  if (pthread_barrier_init(&start, NULL, num_threads + 1)) {
+    fprintf(stderr, "Failed to initialize barrier\n");
+    exit(1);
+  }
+  for (unsigned int i = 0; i < num_threads; i++) {
+    if (pthread_create(&threads[i], NULL, reserve_row, (void*)(size_t)(i + 1))) {
+      fprintf(stderr, "Failed to create thread\n");
+      exit(1);
+    }
+  }
+  pthread_barrier_wait(&start);
+  double begin = now();
+  for (unsigned int i = 0; i < num_threads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  double elapsed = now() - begin;
+  pthread_barrier_destroy(&start);
+  ems_state_destroy(state);
+  return (double)(num_threads * reservations_per_thread) / elapsed;
+}
+
+int main(int argc, char* argv[]) {
+  struct EmsOptions options = {.delay_us = 0, .access_depth = 1, .seat_lock_mode = SEAT_LOCK_SEAT};
+  unsigned int max_threads = 8;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "l:")) != -1) {
+    if (opt != 'l' || parse_seat_lock_mode(optarg, &options.seat_lock_mode)) {
+      fprintf(stderr, USAGE);
+      return 1;
+    }
+  }
+  if (optind < argc) {
+    max_threads = (unsigned int)strtoul(argv[optind++], NULL, 10);
+  }
+  if (optind < argc) {
+    reservations_per_thread = strtoul(argv[optind++], NULL, 10);
+  }
+  if (max_threads == 0 || reservations_per_thread == 0) {
+    fprintf(stderr, USAGE);
+    return 1;
+  }
+
+  if (ems_init(&options)) {
+    return 1;
+  }
+  for (unsigned int num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+    printf("%2u threads: %12.0f reservations/s\n", num_threads, run(num_threads));
+  }
+  ems_terminate();
+  return 0;
+}
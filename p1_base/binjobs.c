@@ -0,0 +1,96 @@
+#include "binjobs.h"
+
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Coordinates are handed to ems_reserve as they are stored
+_Static_assert(sizeof(size_t) == sizeof(uint64_t), "binary jobs files need a 64-bit size_t");
+
+int binjobs_open(struct BinaryJobs* jobs, int fd) {
+  struct stat st;
+  if (fstat(fd, &st) || (size_t)st.st_size < sizeof(struct BinaryHeader)) {
+    return 1;
+  }
+  jobs->size = (size_t)st.st_size;
+  void* data = mmap(NULL, jobs->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    return 1;
+  }
+  jobs->data = data;
+  jobs->offset = sizeof(struct BinaryHeader);
+
+  struct BinaryHeader const* header = data;
+  if (memcmp(header->magic, BINJOBS_MAGIC, sizeof(header->magic)) != 0 || header->version != BINJOBS_VERSION) {
+    binjobs_close(jobs);
+    return 1;
+  }
+  posix_madvise(data, jobs->size, POSIX_MADV_SEQUENTIAL);
+  return 0;
+}
+
+void binjobs_close(struct BinaryJobs* jobs) {
+  munmap((void*)jobs->data, jobs->size);
+  jobs->data = NULL;
+  jobs->size = 0;
+}
+
+size_t binjobs_record_size(size_t num_coords) {
+  return sizeof(struct BinaryRecord) + 2 * num_coords * sizeof(uint64_t);
+}
+
+enum Command binjobs_next(struct BinaryJobs* jobs, struct ParsedCommand* cmd) {
+  size_t left = jobs->size - jobs->offset;
+  if (left == 0) {
+    return cmd->command = EOC;
+  }
+  struct BinaryRecord const* record = (struct BinaryRecord const*)(jobs->data + jobs->offset);
+  if (left < sizeof(struct BinaryRecord) ||
+      (record->command == BIN_RESERVE && record->arg0 > (left - sizeof(struct BinaryRecord)) / (2 * sizeof(uint64_t)))) {
+    // A truncated record ends the file
+    jobs->offset = jobs->size;
+    return cmd->command = CMD_INVALID;
+  }
+  jobs->offset += binjobs_record_size(record->command == BIN_RESERVE ? (size_t)record->arg0 : 0);
+
+  cmd->event_id = record->event_id;
+  switch (record->command) {
+    case BIN_CREATE:
+      // Same range as the text parser, so the number of seats can't overflow
+      if (record->arg0 > UINT32_MAX || record->arg1 > UINT32_MAX) {
+        return cmd->command = CMD_INVALID;
+      }
+      cmd->num_rows = (size_t)record->arg0;
+      cmd->num_cols = (size_t)record->arg1;
+      return cmd->command = CMD_CREATE;
+
+    case BIN_RESERVE:
+      cmd->num_coords = (size_t)record->arg0;
+      cmd->xs = (size_t*)record->coords;
+      cmd->ys = cmd->xs + cmd->num_coords;
+      return cmd->command = cmd->num_coords > 0 ? CMD_RESERVE : CMD_INVALID;
+
+    case BIN_SHOW:
+      return cmd->command = CMD_SHOW;
+
+    case BIN_LIST_EVENTS:
+      return cmd->command = CMD_LIST_EVENTS;
+
+    case BIN_BARRIER:
+      return cmd->command = CMD_BARRIER;
+
+    case BIN_WAIT:
+      if (record->arg0 > UINT32_MAX || record->arg1 > UINT32_MAX) {
+        return cmd->command = CMD_INVALID;
+      }
+      cmd->delay = (unsigned int)record->arg0;
+      cmd->thread_id = (unsigned int)record->arg1;
+      return cmd->command = CMD_WAIT;
+
+    case BIN_HELP:
+      return cmd->command = CMD_HELP;
+
+    default:
+      return cmd->command = CMD_INVALID;
+  }
+}
@@ -0,0 +1,70 @@
+#ifndef EMS_BINJOBS_H
+#define EMS_BINJOBS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "commandqueue.h"
+
+// Binary jobs files (.bjobs): a header followed by one fixed-width record per command, RESERVE records
+// being followed by their rows and then their columns as 64-bit integers. Files are mapped into memory
+// and the coordinates are used in place, so nothing is parsed or copied when they are processed.
+// Every field is in the byte order of the machine, and every record starts 8-byte aligned.
+
+#define BINJOBS_MAGIC "EMSBJOBS"
+#define BINJOBS_VERSION 1
+
+enum BinaryCommand {
+  BIN_CREATE = 1,
+  BIN_RESERVE = 2,
+  BIN_SHOW = 3,
+  BIN_LIST_EVENTS = 4,
+  BIN_BARRIER = 5,
+  BIN_WAIT = 6,
+  BIN_HELP = 7,
+};
+
+struct BinaryHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+};
+
+struct BinaryRecord {
+  uint32_t command;   /// One of enum BinaryCommand.
+  uint32_t event_id;
+  uint64_t arg0;      /// Number of rows, number of seats to reserve, or delay of a WAIT.
+  uint64_t arg1;      /// Number of columns, or thread id of a WAIT, 0 for every thread.
+  uint64_t coords[];  /// Rows of the seats to reserve, then their columns.
+};
+
+/// A mapped binary jobs file being read.
+struct BinaryJobs {
+  char const* data;
+  size_t size;
+  size_t offset;  /// Position of the next record.
+};
+
+/// Maps a binary jobs file.
+/// @param jobs Reader to be initialized.
+/// @param fd File descriptor of the file, may be closed once mapped.
+/// @return 0 if the file was mapped successfully, 1 if it could not be mapped or is not a binary jobs file.
+int binjobs_open(struct BinaryJobs* jobs, int fd);
+
+/// Unmaps a binary jobs file.
+/// @note The coordinates of the RESERVE commands read from it are no longer valid.
+void binjobs_close(struct BinaryJobs* jobs);
+
+/// Reads the next command of a binary jobs file.
+/// @note The coordinates of a RESERVE point into the mapped file and must not be freed.
+/// @param jobs Reader of the file.
+/// @param cmd Command to be filled, its command field is set to the return value.
+/// @return The command read, CMD_INVALID for a malformed record, EOC after the last one.
+enum Command binjobs_next(struct BinaryJobs* jobs, struct ParsedCommand* cmd);
+
+/// Gets the size of a record.
+/// @param num_coords Number of seats of a RESERVE, 0 for other commands.
+/// @return Size in bytes.
+size_t binjobs_record_size(size_t num_coords);
+
+#endif  // EMS_BINJOBS_H
@@ -0,0 +1,108 @@
+#include "commandqueue.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Each cell holds the position it is ready for: a cell with sequence == pos is free for the push of
+// pos, and one with sequence == pos + 1 holds the command for the pop of pos. Positions are claimed
+// with fetch_add, so producers and consumers never take a lock on the data path.
+
+static void wait_semaphore(sem_t* sem) {
+  while (sem_wait(sem)) {
+    if (errno != EINTR) {
+      fprintf(stderr, "Semaphore Error\n");
+      exit(1);
+    }
+  }
+}
+
+static void post_semaphore(sem_t* sem) {
+  if (sem_post(sem)) {
+    fprintf(stderr, "Semaphore Error\n");
+    exit(1);
+  }
+}
+
+/// Waits until a cell is ready for the given position.
+/// @note Only spins when a slower thread still owns a cell that the semaphores already counted.
+static void wait_sequence(struct QueueCell* cell, size_t sequence) {
+  while (atomic_load_explicit(&cell->sequence, memory_order_acquire) != sequence) {
+    sched_yield();
+  }
+}
+
+int queue_init(struct CommandQueue* queue, size_t capacity) {
+  if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+    return 1;
+  }
+
+  queue->cells = malloc(capacity * sizeof(struct QueueCell));
+  if (queue->cells == NULL) {
+    return 1;
+  }
+  for (size_t i = 0; i < capacity; i++) {
+    atomic_init(&queue->cells[i].sequence, i);
+  }
+  queue->mask = capacity - 1;
+  atomic_init(&queue->enqueue_pos, 0);
+  atomic_init(&queue->dequeue_pos, 0);
+
+  if (sem_init(&queue->items, 0, 0) || sem_init(&queue->slots, 0, (unsigned int)capacity)) {
+    free(queue->cells);
+    return 1;
+  }
+
+  return 0;
+}
+
+void queue_destroy(struct CommandQueue* queue) {
+  if (sem_destroy(&queue->items) || sem_destroy(&queue->slots)) {
+    fprintf(stderr, "Semaphore Error\n");
+    exit(1);
+  }
+  free(queue->cells);
+}
+
+void queue_push(struct CommandQueue* queue, struct ParsedCommand const* command) {
+  wait_semaphore(&queue->slots);
+
+  size_t pos = atomic_fetch_add_explicit(&queue->enqueue_pos, 1, memory_order_relaxed);
+  struct QueueCell* cell = &queue->cells[pos & queue->mask];
+  wait_sequence(cell, pos);
+  cell->command = *command;
+  atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+
+  post_semaphore(&queue->items);
+}
+
+/// Pops the command of a cell counted by the items semaphore.
+static void pop_cell(struct CommandQueue* queue, struct ParsedCommand* command) {
+  size_t pos = atomic_fetch_add_explicit(&queue->dequeue_pos, 1, memory_order_relaxed);
+  struct QueueCell* cell = &queue->cells[pos & queue->mask];
+  wait_sequence(cell, pos + 1);
+  *command = cell->command;
+  atomic_store_explicit(&cell->sequence, pos + queue->mask + 1, memory_order_release);
+
+  post_semaphore(&queue->slots);
+}
+
+void queue_pop(struct CommandQueue* queue, struct ParsedCommand* command) {
+  wait_semaphore(&queue->items);
+  pop_cell(queue, command);
+}
+
+int queue_trypop(struct CommandQueue* queue, struct ParsedCommand* command) {
+  while (sem_trywait(&queue->items)) {
+    if (errno == EAGAIN) {
+      return 1;
+    }
+    if (errno != EINTR) {
+      fprintf(stderr, "Semaphore Error\n");
+      exit(1);
+    }
+  }
+  pop_cell(queue, command);
+  return 0;
+}
@@ -0,0 +1,74 @@
+#ifndef EMS_COMMAND_QUEUE_H
+#define EMS_COMMAND_QUEUE_H
+
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "parser.h"
+
+/// Command parsed ahead of its execution.
+struct ParsedCommand {
+  enum Command command;  /// Type of the command.
+  unsigned int event_id;
+
+  size_t num_rows;
+  size_t num_cols;
+
+  size_t num_coords;
+  size_t* xs;  /// Rows of the seats to reserve, owned by the command unless read from a binary jobs file.
+  size_t* ys;  /// Columns of the seats to reserve, in the same allocation or mapping as xs.
+
+  unsigned int delay;
+  unsigned int thread_id;
+
+  unsigned long creates_before;  /// Number of CREATE commands that precede this one in the file.
+  unsigned long seq;             /// Position of the command among the queued commands of the file.
+  unsigned long wait_for;        /// Number of commands that must be written first, in ordered mode.
+};
+
+struct QueueCell {
+  atomic_size_t sequence;  /// Position the cell is ready for (see commandqueue.c).
+  struct ParsedCommand command;
+};
+
+/// Bounded ring buffer of parsed commands.
+/// Cells are claimed without locks, the semaphores only block when the queue is full or empty.
+struct CommandQueue {
+  struct QueueCell* cells;
+  size_t mask;  /// Capacity - 1, the capacity is a power of two.
+
+  atomic_size_t enqueue_pos;
+  atomic_size_t dequeue_pos;
+
+  sem_t items;  /// Number of commands ready to be popped.
+  sem_t slots;  /// Number of free cells.
+};
+
+/// Initializes a command queue.
+/// @param queue Queue to be initialized.
+/// @param capacity Number of cells, must be a power of two.
+/// @return 0 if the queue was initialized successfully, 1 otherwise.
+int queue_init(struct CommandQueue* queue, size_t capacity);
+
+/// Destroys a command queue.
+/// @param queue Queue to be destroyed, must be empty.
+void queue_destroy(struct CommandQueue* queue);
+
+/// Pushes a command to the queue, waiting while it is full.
+/// @param queue Queue to be modified.
+/// @param command Command to be copied into the queue.
+void queue_push(struct CommandQueue* queue, struct ParsedCommand const* command);
+
+/// Pops the oldest command from the queue, waiting while it is empty.
+/// @param queue Queue to be modified.
+/// @param command Pointer to the variable to store the command in.
+void queue_pop(struct CommandQueue* queue, struct ParsedCommand* command);
+
+/// Pops the oldest command from the queue if there is one, without waiting.
+/// @param queue Queue to be modified.
+/// @param command Pointer to the variable to store the command in.
+/// @return 0 if a command was popped, 1 if the queue was empty.
+int queue_trypop(struct CommandQueue* queue, struct ParsedCommand* command);
+
+#endif  // EMS_COMMAND_QUEUE_H
@@ -1,2 +1,19 @@
-#define MAX_RESERVATION_SIZE 256
+#define MAX_RESERVATION_SIZE 256  // Default, can be changed with -r
+#define CACHE_LINE_SIZE 64
 #define STATE_ACCESS_DELAY_MS 10
+#define STATE_DELAY_MAX_DEPTH 64  // Largest number of state accesses a thread keeps in flight, see -q
+#define MAX_FIBERS 4096  // Largest number of commands a pool worker runs at once, see -c
+#define FIBER_STACK_SIZE ((size_t)1 << 17)
+#define FIBER_POLL_INTERVAL_NS 20000  // Time a fiber waiting on another one leaves to the rest, see fiber_yield
+#define PARSER_BUFFER_SIZE 65536
+#define PARSER_MAX_FDS 1024
+#define COMMAND_QUEUE_SIZE 64
+#define OUTPUT_CHUNK_SIZE 65536
+#define OUTPUT_FLUSH_SIZE 262144
+#define OUTPUT_MAX_CHUNKS 16
+#define REORDER_BUFFER_SIZE 1024
+#define DEPENDENCY_SLOTS 4096
+#define STORE_WINDOW_SIZE ((size_t)1 << 32)  // Largest size of the persistent store
+#define STORE_INITIAL_SIZE ((size_t)1 << 20)
+#define WAL_BUFFER_SIZE 65536
+#define ARENA_CHUNK_SIZE ((size_t)1 << 18)
@@ -3,107 +3,211 @@
 
 #include <stdlib.h>
 
+#include "instrument.h"
+#include "statemem.h"
+
+#define EVENT_TABLE_MIN_CAPACITY 64
+
+/// Block allocated for each event, see list_alloc_event.
+struct EventBlock {
+  struct Event event;
+  struct ListNode node;  /// Only written when the event is appended and when the next one is.
+  atomic_uint seats[];
+};
+
+/// Hashes an event id into a table slot.
+/// @param event_id Event id to be hashed.
+/// @param mask Mask of the table.
+/// @return Index of the first slot to probe.
+static size_t event_hash(unsigned int event_id, size_t mask) {
+  unsigned int h = event_id;
+  h ^= h >> 16;
+  h *= 0x85ebca6bU;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35U;
+  h ^= h >> 16;
+  return (size_t)h & mask;
+}
+
+/// Creates an empty event table.
+/// @param capacity Number of slots, must be a power of two.
+/// @return Newly created table, NULL on failure.
+static struct EventTable* create_table(size_t capacity) {
+  struct EventTable* table = state_alloc(sizeof(struct EventTable) + capacity * sizeof(_Atomic(struct Event*)));
+  if (!table) return NULL;
+  table->mask = capacity - 1;
+  table->previous = NULL;
+  for (size_t i = 0; i < capacity; i++) {
+    atomic_init(&table->slots[i], NULL);
+  }
+  return table;
+}
+
+/// Stores an event in the first free slot of its probe sequence.
+/// @note Must be called with the list write lock held, publishes the event to lock-free readers.
+static void table_insert(struct EventTable* table, struct Event* event) {
+  size_t i = event_hash(event->id, table->mask);
+  while (atomic_load_explicit(&table->slots[i], memory_order_relaxed) != NULL) {
+    i = (i + 1) & table->mask;
+  }
+  atomic_store_explicit(&table->slots[i], event, memory_order_release);
+}
+
+/// Looks up an event in a table.
+/// @return Pointer to the event if found, NULL otherwise.
+static struct Event* table_find(struct EventTable* table, unsigned int event_id) {
+  size_t i = event_hash(event_id, table->mask);
+  struct Event* event;
+  while ((event = atomic_load_explicit(&table->slots[i], memory_order_acquire)) != NULL) {
+    if (event->id == event_id) {
+      return event;
+    }
+    i = (i + 1) & table->mask;
+  }
+  return NULL;
+}
+
+/// Replaces the table of the list with one twice as large.
+/// @note Must be called with the list write lock held. The old table stays allocated until the list
+/// is freed, since lock-free readers may still be probing it.
+/// @return 0 if the table was grown successfully, 1 otherwise.
+static int grow_table(struct EventList* list) {
+  struct EventTable* old_table = atomic_load_explicit(&list->table, memory_order_relaxed);
+  struct EventTable* new_table = create_table((old_table->mask + 1) * 2);
+  if (!new_table) return 1;
+
+  struct ListNode* current = atomic_load_explicit(&list->head, memory_order_relaxed);
+  for (; current; current = atomic_load_explicit(&current->next, memory_order_relaxed)) {
+    table_insert(new_table, current->event);
+  }
+  new_table->previous = old_table;
+  atomic_store_explicit(&list->table, new_table, memory_order_release);
+  return 0;
+}
+
 struct EventList* create_list() {
-  struct EventList* list = (struct EventList*)malloc(sizeof(struct EventList));
+  struct EventList* list = (struct EventList*)state_alloc(sizeof(struct EventList));
   if (!list) return NULL;
-  list->head = NULL;
+  atomic_init(&list->head, NULL);
   list->tail = NULL;
-  if (pthread_rwlock_init(&list->list_lock, NULL)) {
+  list->size = 0;
+  struct EventTable* table = create_table(EVENT_TABLE_MIN_CAPACITY);
+  if (!table) {
+    state_free(list);
+    return NULL;
+  }
+  atomic_init(&list->table, table);
+  if (state_mutex_init(&list->list_lock) || arena_init(&list->arena)) {
     fprintf(stderr, "Lock Error\n");
     exit(1);
   }
   return list;
 }
 
-int append_to_list(struct EventList* list, struct Event* event) {
-  if (!list) return 1;
+struct Event* list_alloc_event(struct EventList* list, size_t num_seats) {
+  if (num_seats > ((size_t)-1 - sizeof(struct EventBlock)) / sizeof(atomic_uint)) {
+    return NULL;
+  }
+  struct EventBlock* block = arena_alloc(&list->arena, sizeof(struct EventBlock) + num_seats * sizeof(atomic_uint));
+  if (!block) return NULL;
 
-  struct ListNode* new_node = (struct ListNode*)malloc(sizeof(struct ListNode));
-  if (!new_node) return 1;
+  block->event.data = num_seats > 0 ? block->seats : NULL;
+  return &block->event;
+}
 
-  new_node->event = event;
-  new_node->next = NULL;
+void list_discard_event(struct EventList* list, struct Event* event) {
+  arena_free(&list->arena, (struct EventBlock*)event);
+}
 
-  if (pthread_rwlock_wrlock(&list->list_lock)) {
+int list_reserve(struct EventList* list) {
+  if (pthread_mutex_lock(&list->list_lock)) {
     fprintf(stderr, "Lock Error\n");
     exit(1);
   }
-  if (list->head == NULL) {
-    list->head = new_node;
-    list->tail = new_node;
-  } else {
-    list->tail->next = new_node;
-    list->tail = new_node;
-  }
-  if (pthread_rwlock_unlock(&list->list_lock)) {
+  struct EventTable* table = atomic_load_explicit(&list->table, memory_order_relaxed);
+  int failed = (list->size + 1) * 2 > table->mask + 1 && grow_table(list);
+  if (pthread_mutex_unlock(&list->list_lock)) {
     fprintf(stderr, "Lock Error\n");
     exit(1);
   }
-
-  return 0;
+  return failed;
 }
 
-static void free_event(struct Event* event) {
-  if (!event) return;
+int append_to_list(struct EventList* list, struct Event* event) {
+  if (!list) return 1;
+
+  struct ListNode* new_node = &((struct EventBlock*)event)->node;
+  new_node->event = event;
+  atomic_init(&new_node->next, NULL);
 
-  free(event->data);
-  for (size_t i = 0; i < event->rows * event->cols; i++) {
-    if (pthread_rwlock_destroy(&event->seatlocks[i])) {
+  INSTRUMENT_START(start);
+  if (pthread_mutex_lock(&list->list_lock)) {
+    fprintf(stderr, "Lock Error\n");
+    exit(1);
+  }
+  INSTRUMENT_END(INSTR_LIST_LOCK, start);
+  struct EventTable* table = atomic_load_explicit(&list->table, memory_order_relaxed);
+  int failed = table_find(table, event->id) != NULL;
+  if (!failed && (list->size + 1) * 2 > table->mask + 1) {
+    failed = grow_table(list);
+    table = atomic_load_explicit(&list->table, memory_order_relaxed);
+  }
+  if (failed) {
+    if (pthread_mutex_unlock(&list->list_lock)) {
       fprintf(stderr, "Lock Error\n");
       exit(1);
     }
+    return 1;
+  }
+
+  if (list->tail == NULL) {
+    atomic_store_explicit(&list->head, new_node, memory_order_release);
+  } else {
+    atomic_store_explicit(&list->tail->next, new_node, memory_order_release);
   }
-  free(event->seatlocks);
-  if (pthread_rwlock_destroy(&event->event_lock)) {
+  list->tail = new_node;
+  list->size++;
+  table_insert(table, event);
+  if (pthread_mutex_unlock(&list->list_lock)) {
     fprintf(stderr, "Lock Error\n");
     exit(1);
   }
-  pthread_mutex_destroy(&event->reservation_lock);
-  free(event);
+
+  return 0;
 }
 
 void free_list(struct EventList* list) {
   if (!list) return;
 
-  struct ListNode* current = list->head;
-  while (current) {
-    struct ListNode* temp = current;
-    current = current->next;
-
-    free_event(temp->event);
-    free(temp);
+  struct ListNode* current = atomic_load_explicit(&list->head, memory_order_relaxed);
+  for (; current; current = atomic_load_explicit(&current->next, memory_order_relaxed)) {
+    seatlocks_destroy(&current->event->seatlocks);
+  }
+  arena_destroy(&list->arena);
+  struct EventTable* table = atomic_load_explicit(&list->table, memory_order_relaxed);
+  while (table) {
+    struct EventTable* previous = table->previous;
+    state_free(table);
+    table = previous;
   }
-  if (pthread_rwlock_destroy(&list->list_lock)) {
+  if (pthread_mutex_destroy(&list->list_lock)) {
     fprintf(stderr, "Lock Error\n");
     exit(1);
   }
 
-  free(list);
+  state_free(list);
 }
 
-struct Event* get_event(struct EventList* list, unsigned int event_id) {
+struct ListNode* list_head(struct EventList* list) {
   if (!list) return NULL;
 
-  if (pthread_rwlock_rdlock(&list->list_lock)) {
-    fprintf(stderr, "Lock Error\n");
-    exit(1);
-  }
-  struct ListNode* current = list->head;
-  while (current) {
-    struct Event* event = current->event;
-    if (event->id == event_id) {
-      if (pthread_rwlock_unlock(&list->list_lock)) {
-        fprintf(stderr, "Lock Error\n");
-        exit(1);
-      }
-      return event;
-    }
-    current = current->next;//
-  }
-  if (pthread_rwlock_unlock(&list->list_lock)) {
-    fprintf(stderr, "Lock Error\n");
-    exit(1);
-  }
+  return atomic_load_explicit(&list->head, memory_order_acquire);
+}
 
-  return NULL;
+struct ListNode* list_next(struct ListNode* node) { return atomic_load_explicit(&node->next, memory_order_acquire); }
+
+struct Event* get_event(struct EventList* list, unsigned int event_id) {
+  if (!list) return NULL;
+
+  return table_find(atomic_load_explicit(&list->table, memory_order_acquire), event_id);
 }
@@ -2,49 +2,107 @@
 #define EVENT_LIST_H
 
 #include <stddef.h>
+#include <stdatomic.h>
 #include <pthread.h>
 
+#include "arena.h"
+#include "constants.h"
+#include "seatlock.h"
+
+// Fields set at creation and read by every access come first, the counters written by every
+// reservation get a cache line of their own, so reservations don't evict the line lookups read.
+// Events must be allocated CACHE_LINE_SIZE aligned, see list_alloc_event.
 struct Event {
-  unsigned int id;            /// Event id
-  unsigned int reservations;  /// Number of reservations for the event.
+  // Read-only once the event is created
+  _Alignas(CACHE_LINE_SIZE) unsigned int id;  /// Event id
+  int stored;         /// Whether data lives in the persistent store (see store.h) rather than being owned by the event.
 
   size_t cols;  /// Number of columns.
   size_t rows;  /// Number of rows.
 
-  unsigned int* data;  /// Array of size rows * cols with the reservations for each seat.
-  pthread_rwlock_t* seatlocks; /// Array of size rows * cols with locks for each seat.
-  pthread_rwlock_t event_lock;
-  pthread_mutex_t reservation_lock;
+  atomic_uint* data;  /// Array of size rows * cols with the reservations for each seat.
+  struct SeatLocks seatlocks;  /// Locks for the seats, see seatlock.h for the granularity.
+
+  // Written by every reservation
+  _Alignas(CACHE_LINE_SIZE) atomic_uint reservations;  /// Number of reservations for the event, the last id handed out.
+  atomic_uint committing;      /// Number of reservations writing their id to the seats.
+  atomic_ulong seat_version;   /// Number of reservations committed, lets readers validate their snapshots.
 };
 
 struct ListNode {
   struct Event* event;
-  struct ListNode* next;
+  _Atomic(struct ListNode*) next;  // Published with release semantics, see list_next
+};
+
+// Open addressing hash index of the events, keyed by event id
+struct EventTable {
+  size_t mask;                     // Capacity - 1, the capacity is a power of two
+  struct EventTable* previous;     // Smaller table replaced by this one, kept for concurrent readers
+  _Atomic(struct Event*) slots[];  // Events, NULL for empty slots
 };
 
 // Linked list structure
+// Events are never removed before free_list, so readers traverse the list and the index without
+// locks or atomic read-modify-writes: appends publish nodes and tables with release stores, readers
+// see them with acquire loads, and nothing a reader may hold is reclaimed while the list is in use.
 struct EventList {
-  struct ListNode* head;  // Head of the list
-  struct ListNode* tail;  // Tail of the list
-  pthread_rwlock_t list_lock;
+  _Atomic(struct ListNode*) head;     // Head of the list
+  struct ListNode* tail;              // Tail of the list, only used by writers
+  size_t size;                        // Number of events in the list
+  _Atomic(struct EventTable*) table;  // Index used by get_event, read without locks
+  pthread_mutex_t list_lock;          // Serializes writers only
+  struct Arena arena;                 // Events, their nodes and their seats, freed together with the list
 };
 
 /// Creates a new event list.
 /// @return Newly created event list, NULL on failure
 struct EventList* create_list();
 
-/// Appends a new node to the list.
+/// Allocates an event for a list, in one block with its node and its seats.
+/// @note The block comes from the arena of the list and is freed with it, see list_discard_event for
+/// events that don't make it into the list.
+/// @param list Event list the event is for.
+/// @param num_seats Number of seats to allocate after the event, 0 if they are kept elsewhere.
+/// @return Event with data pointing to its seats, if any, NULL on failure.
+struct Event* list_alloc_event(struct EventList* list, size_t num_seats);
+
+/// Gives back an event allocated by list_alloc_event that was not appended to the list.
+/// @param list Event list the event was allocated for.
+/// @param event Event to be discarded, its locks must already be destroyed.
+void list_discard_event(struct EventList* list, struct Event* event);
+
+/// Appends an event to the list, using the node allocated with it.
 /// @param list Event list to be modified.
-/// @param data Event to be stored in the new node.
-/// @return 0 if the node was appended successfully, 1 otherwise.
+/// @param data Event allocated by list_alloc_event for the list.
+/// @return 0 if the node was appended successfully, 1 otherwise (including when the event id is taken).
 int append_to_list(struct EventList* list, struct Event* data);
 
-/// Removes a node from the list.
+/// Makes room in the lookup table of the list for one more event.
+/// @note With the room reserved, append_to_list can only fail if the event id is taken, as long as no
+/// other event is appended in between.
 /// @param list Event list to be modified.
-/// @return 0 if the node was removed successfully, 1 otherwise.
+/// @return 0 if there is room, 1 otherwise.
+int list_reserve(struct EventList* list);
+
+/// Frees a list with its events.
+/// @note Only the seat locks of the events are destroyed one by one, their memory goes with the arena.
+/// @param list Event list to be freed.
 void free_list(struct EventList* list);
 
+/// Gets the first node of the list.
+/// @note Does not take any lock, the list can be traversed while events are appended.
+/// @param list Event list to be traversed.
+/// @return First node, NULL if the list is empty.
+struct ListNode* list_head(struct EventList* list);
+
+/// Gets the node that follows another one.
+/// @note Does not take any lock, the list can be traversed while events are appended.
+/// @param node Node of the list.
+/// @return Next node, NULL if node is the last one.
+struct ListNode* list_next(struct ListNode* node);
+
 /// Retrieves an event in the list.
+/// @note Does not take any lock, events appended concurrently may or may not be found.
 /// @param list Event list to be searched
 /// @param event_id Event id.
 /// @return Pointer to the event if found, NULL otherwise.
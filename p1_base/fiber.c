@@ -0,0 +1,322 @@
+#include "fiber.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "statedelay.h"
+
+// Sanitizers can't follow switches between stacks on their own, each one is announced to them
+#ifdef __SANITIZE_ADDRESS__
+#include <sanitizer/common_interface_defs.h>
+#endif
+#ifdef __SANITIZE_THREAD__
+#include <sanitizer/tsan_interface.h>
+#endif
+
+struct Fiber {
+  ucontext_t context;
+  char* stack;                    /// FIBER_STACK_SIZE bytes, the lowest page a guard. NULL until first used.
+  struct DelayQueue delay_queue;  /// State accesses in flight of the fiber.
+  unsigned long long due;         /// CLOCK_MONOTONIC time in ns the fiber may run again, 0 for right away.
+  int in_flight;                  /// Whether the fiber has started and not ended yet.
+  void (*entry)(void* arg);
+  void* arg;
+#ifdef __SANITIZE_ADDRESS__
+  void* fake_stack;
+#endif
+#ifdef __SANITIZE_THREAD__
+  void* tsan_fiber;
+#endif
+};
+
+/// Fibers of a thread.
+struct FiberScheduler {
+  ucontext_t context;     /// Context of the thread, switched back to whenever a fiber waits or ends.
+  struct Fiber* fibers;   /// Array of max_fibers fibers.
+  size_t max_fibers;
+  size_t in_flight;
+  size_t* idle;           /// Stack of the indexes of the fibers not in flight.
+  size_t num_idle;
+  size_t* waiting;        /// Min-heap by due of the indexes of the fibers in flight that aren't running.
+  size_t num_waiting;
+  size_t* ready;          /// Indexes of the fibers taken off waiting to be run by fibers_run.
+  struct Fiber* current;  /// Fiber being run, NULL while the thread runs its own code.
+#ifdef __SANITIZE_ADDRESS__
+  void const* thread_stack;
+  size_t thread_stack_size;
+#endif
+#ifdef __SANITIZE_THREAD__
+  void* tsan_thread;
+#endif
+};
+
+static _Thread_local struct FiberScheduler* scheduler = NULL;
+
+static unsigned long long monotonic_ns() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec;
+}
+
+int fibers_init(size_t max_fibers) {
+  scheduler = calloc(1, sizeof(struct FiberScheduler));
+  if (scheduler == NULL) {
+    return 1;
+  }
+  scheduler->fibers = calloc(max_fibers, sizeof(struct Fiber));
+  scheduler->idle = malloc(max_fibers * sizeof(size_t));
+  scheduler->waiting = malloc(max_fibers * sizeof(size_t));
+  scheduler->ready = malloc(max_fibers * sizeof(size_t));
+  if (scheduler->fibers == NULL || scheduler->idle == NULL || scheduler->waiting == NULL ||
+      scheduler->ready == NULL) {
+    fibers_destroy();
+    return 1;
+  }
+  scheduler->max_fibers = max_fibers;
+  // Fibers are taken from the top, so the lowest indexes are reused first
+  for (size_t i = 0; i < max_fibers; i++) {
+    scheduler->idle[i] = max_fibers - 1 - i;
+  }
+  scheduler->num_idle = max_fibers;
+#ifdef __SANITIZE_THREAD__
+  scheduler->tsan_thread = __tsan_get_current_fiber();
+#endif
+  return 0;
+}
+
+void fibers_destroy() {
+  if (scheduler == NULL) {
+    return;
+  }
+  long page_size = sysconf(_SC_PAGESIZE);
+  for (size_t i = 0; scheduler->fibers != NULL && i < scheduler->max_fibers; i++) {
+    char* stack = scheduler->fibers[i].stack;
+    if (stack != NULL) {
+      mprotect(stack, (size_t)page_size, PROT_READ | PROT_WRITE);
+      free(stack);
+#ifdef __SANITIZE_THREAD__
+      __tsan_destroy_fiber(scheduler->fibers[i].tsan_fiber);
+#endif
+    }
+  }
+  free(scheduler->fibers);
+  free(scheduler->idle);
+  free(scheduler->waiting);
+  free(scheduler->ready);
+  free(scheduler);
+  scheduler = NULL;
+}
+
+/// Gets the time a waiting fiber is due.
+static unsigned long long waiting_due(size_t position) {
+  return scheduler->fibers[scheduler->waiting[position]].due;
+}
+
+/// Swaps two waiting fibers.
+static void swap_waiting(size_t a, size_t b) {
+  size_t index = scheduler->waiting[a];
+  scheduler->waiting[a] = scheduler->waiting[b];
+  scheduler->waiting[b] = index;
+}
+
+/// Adds a fiber to the ones waiting to be due.
+static void push_waiting(struct Fiber* fiber) {
+  size_t position = scheduler->num_waiting++;
+  scheduler->waiting[position] = (size_t)(fiber - scheduler->fibers);
+  while (position > 0 && waiting_due((position - 1) / 2) > waiting_due(position)) {
+    swap_waiting(position, (position - 1) / 2);
+    position = (position - 1) / 2;
+  }
+}
+
+/// Takes the waiting fiber that is due first.
+/// @return Index of the fiber.
+static size_t pop_waiting() {
+  size_t first = scheduler->waiting[0];
+  scheduler->waiting[0] = scheduler->waiting[--scheduler->num_waiting];
+  size_t position = 0;
+  while (1) {
+    size_t earliest = position;
+    size_t left = 2 * position + 1, right = left + 1;
+    if (left < scheduler->num_waiting && waiting_due(left) < waiting_due(earliest)) {
+      earliest = left;
+    }
+    if (right < scheduler->num_waiting && waiting_due(right) < waiting_due(earliest)) {
+      earliest = right;
+    }
+    if (earliest == position) {
+      return first;
+    }
+    swap_waiting(position, earliest);
+    position = earliest;
+  }
+}
+
+/// Switches from the thread to a fiber, until the fiber waits or ends.
+static void switch_to_fiber(struct Fiber* fiber) {
+  scheduler->current = fiber;
+#ifdef __SANITIZE_ADDRESS__
+  void* fake_stack;
+  __sanitizer_start_switch_fiber(&fake_stack, fiber->stack, FIBER_STACK_SIZE);
+#endif
+#ifdef __SANITIZE_THREAD__
+  __tsan_switch_to_fiber(fiber->tsan_fiber, 0);
+#endif
+  if (swapcontext(&scheduler->context, &fiber->context)) {
+    fprintf(stderr, "Error switching to a fiber\n");
+    exit(1);
+  }
+#ifdef __SANITIZE_ADDRESS__
+  __sanitizer_finish_switch_fiber(fake_stack, NULL, NULL);
+#endif
+  scheduler->current = NULL;
+}
+
+/// Completes a switch to the current fiber, on its stack.
+static void arrive_on_fiber() {
+#ifdef __SANITIZE_ADDRESS__
+  __sanitizer_finish_switch_fiber(scheduler->current->fake_stack, &scheduler->thread_stack,
+                                  &scheduler->thread_stack_size);
+#endif
+}
+
+/// Switches from the current fiber back to the thread.
+/// @param ended Whether the fiber has ended, in which case it never runs again.
+static void switch_to_thread(int ended) {
+  struct Fiber* fiber = scheduler->current;
+#ifdef __SANITIZE_ADDRESS__
+  __sanitizer_start_switch_fiber(ended ? NULL : &fiber->fake_stack, scheduler->thread_stack,
+                                 scheduler->thread_stack_size);
+#endif
+#ifdef __SANITIZE_THREAD__
+  __tsan_switch_to_fiber(scheduler->tsan_thread, 0);
+#endif
+  if (ended) {
+    setcontext(&scheduler->context);
+  }
+  if (swapcontext(&fiber->context, &scheduler->context)) {
+    fprintf(stderr, "Error switching to a fiber\n");
+    exit(1);
+  }
+  arrive_on_fiber();
+}
+
+/// Runs the function of the current fiber, then switches back to the thread for good.
+static void fiber_main() {
+  arrive_on_fiber();
+  struct Fiber* fiber = scheduler->current;
+  fiber->entry(fiber->arg);
+
+  fiber->in_flight = 0;
+  scheduler->in_flight--;
+  scheduler->idle[scheduler->num_idle++] = (size_t)(fiber - scheduler->fibers);
+  switch_to_thread(1);
+}
+
+/// Allocates the stack of a fiber, with a guard page that turns an overflow into a crash.
+static char* alloc_stack() {
+  size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+  void* stack;
+  if (posix_memalign(&stack, page_size, FIBER_STACK_SIZE)) {
+    return NULL;
+  }
+  if (mprotect(stack, page_size, PROT_NONE)) {
+    free(stack);
+    return NULL;
+  }
+  return stack;
+}
+
+int fiber_start(void (*entry)(void* arg), void* arg) {
+  if (scheduler->num_idle == 0) {
+    return 1;
+  }
+  struct Fiber* fiber = &scheduler->fibers[scheduler->idle[scheduler->num_idle - 1]];
+  if (fiber->stack == NULL) {
+    fiber->stack = alloc_stack();
+    if (fiber->stack == NULL) {
+      fprintf(stderr, "Error allocating memory for a fiber\n");
+      exit(1);
+    }
+#ifdef __SANITIZE_THREAD__
+    fiber->tsan_fiber = __tsan_create_fiber(0);
+#endif
+  }
+  if (getcontext(&fiber->context)) {
+    fprintf(stderr, "Error creating a fiber\n");
+    exit(1);
+  }
+  fiber->context.uc_stack.ss_sp = fiber->stack;
+  fiber->context.uc_stack.ss_size = FIBER_STACK_SIZE;
+  fiber->context.uc_link = NULL;
+  makecontext(&fiber->context, fiber_main, 0);
+
+  memset(&fiber->delay_queue, 0, sizeof(fiber->delay_queue));
+  fiber->due = 0;
+  fiber->in_flight = 1;
+  fiber->entry = entry;
+  fiber->arg = arg;
+  scheduler->num_idle--;
+  scheduler->in_flight++;
+  push_waiting(fiber);
+  return 0;
+}
+
+size_t fibers_in_flight() { return scheduler->in_flight; }
+
+unsigned long long fibers_run() {
+  // The due fibers are taken off first, so each one runs once even if it is due again right away
+  unsigned long long now = monotonic_ns();
+  size_t num_ready = 0;
+  while (scheduler->num_waiting > 0 && waiting_due(0) <= now) {
+    scheduler->ready[num_ready++] = pop_waiting();
+  }
+
+  for (size_t i = 0; i < num_ready; i++) {
+    struct Fiber* fiber = &scheduler->fibers[scheduler->ready[i]];
+    switch_to_fiber(fiber);
+    if (fiber->in_flight) {
+      push_waiting(fiber);
+    }
+  }
+  return scheduler->num_waiting > 0 ? waiting_due(0) : ULLONG_MAX;
+}
+
+void fibers_wait(unsigned long long due) {
+  if (due == 0) {
+    sched_yield();
+    return;
+  }
+  struct timespec until = {(time_t)(due / 1000000000ULL), (long)(due % 1000000000ULL)};
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR) {
+  }
+}
+
+int fiber_running() { return scheduler != NULL && scheduler->current != NULL; }
+
+void fiber_yield() {
+  if (!fiber_running()) {
+    sched_yield();
+    return;
+  }
+  scheduler->current->due = monotonic_ns() + FIBER_POLL_INTERVAL_NS;
+  switch_to_thread(0);
+}
+
+void fiber_sleep_until(unsigned long long deadline) {
+  scheduler->current->due = deadline;
+  switch_to_thread(0);
+}
+
+struct DelayQueue* fiber_delay_queue() {
+  return fiber_running() ? &scheduler->current->delay_queue : NULL;
+}
@@ -0,0 +1,55 @@
+#ifndef EMS_FIBER_H
+#define EMS_FIBER_H
+
+#include <stddef.h>
+
+// Cooperative fibers, each running one function on a stack of its own. The fibers of a thread are only
+// run by that thread, one at a time, and switch to each other whenever one of them waits, so a thread
+// can keep many commands in flight while they wait on the state (see statedelay.h). Code that may run
+// on a fiber must not block its thread on something another fiber of it may have to do first.
+
+struct DelayQueue;
+
+/// Sets up the calling thread to run fibers.
+/// @param max_fibers Largest number of fibers the thread runs at once.
+/// @return 0 if the thread was set up successfully, 1 otherwise.
+int fibers_init(size_t max_fibers);
+
+/// Frees the fibers of the calling thread, once none of them is in flight.
+void fibers_destroy();
+
+/// Starts a fiber on the calling thread, run by the next call to fibers_run.
+/// @param entry Function the fiber runs, the fiber ends when it returns.
+/// @param arg Argument of the function.
+/// @return 0 if the fiber was started, 1 if the thread runs max_fibers already.
+int fiber_start(void (*entry)(void* arg), void* arg);
+
+/// Gets the number of fibers of the calling thread that have started and not ended yet.
+size_t fibers_in_flight();
+
+/// Runs every fiber of the calling thread that is due, until each one waits or ends.
+/// @return CLOCK_MONOTONIC time in ns the next fiber is due, 0 if one is due already and ULLONG_MAX
+/// if there are no fibers in flight.
+unsigned long long fibers_run();
+
+/// Waits until the next fiber of the calling thread is due.
+/// @param due Time the next fiber is due, as returned by fibers_run.
+void fibers_wait(unsigned long long due);
+
+/// Checks whether the caller runs on a fiber.
+/// @return 1 if it does, 0 otherwise.
+int fiber_running();
+
+/// Lets the other fibers of the thread run, or the other threads when not running on a fiber.
+/// @note Meant for waits that poll: the fiber is due again as soon as the others have run.
+void fiber_yield();
+
+/// Lets the other fibers of the thread run until a point of the monotonic clock.
+/// @param deadline CLOCK_MONOTONIC time in ns the running fiber is due again.
+void fiber_sleep_until(unsigned long long deadline);
+
+/// Gets the state accesses in flight of the running fiber.
+/// @return The queue, NULL when not running on a fiber.
+struct DelayQueue* fiber_delay_queue();
+
+#endif  // EMS_FIBER_H
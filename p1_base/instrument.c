@@ -0,0 +1,181 @@
+#include "instrument.h"
+
+#ifdef EMS_INSTRUMENT
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+// Log-linear buckets: values below 2^SUB_BITS have a bucket each, larger ones get 2^SUB_BITS buckets
+// per power of two, so every bucket is within 1 / 2^SUB_BITS of the values it counts
+#define SUB_BITS 4
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define HISTOGRAM_BUCKETS ((64 - SUB_BITS + 1) * SUB_BUCKETS)
+
+static const char* point_names[INSTR_POINTS] = {
+    [INSTR_EMS_CREATE] = "ems_create",     [INSTR_EMS_RESERVE] = "ems_reserve",
+    [INSTR_EMS_SHOW] = "ems_show",         [INSTR_EMS_LIST] = "ems_list_events",
+    [INSTR_EMS_WAIT] = "ems_wait",         [INSTR_PARSE] = "parse command",
+    [INSTR_LIST_LOCK] = "list lock",       [INSTR_SEAT_LOCK] = "seat lock",
+    [INSTR_REORDER_LOCK] = "reorder lock", [INSTR_PROGRESS_LOCK] = "progress lock",
+    [INSTR_POOL_LOCK] = "pool lock",       [INSTR_OUTPUT_WRITE] = "output write",
+    [INSTR_WAL_WAIT] = "log wait",
+};
+
+/// Operations recorded by one thread.
+/// Only the thread writes them, with plain loads and stores, the atomics let the dump read them meanwhile.
+struct ThreadStats {
+  struct ThreadStats* next;
+  atomic_ulong count[INSTR_POINTS];
+  atomic_ulong total_ns[INSTR_POINTS];
+  atomic_ulong max_ns[INSTR_POINTS];
+  atomic_ulong buckets[INSTR_POINTS][HISTOGRAM_BUCKETS];
+};
+
+static _Thread_local struct ThreadStats* thread_stats = NULL;
+static struct ThreadStats* all_stats = NULL;  // Every thread's stats, kept after the threads exit
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile sig_atomic_t dump_requested = 0;
+
+static void request_dump(int signum) {
+  (void)signum;
+  dump_requested = 1;
+}
+
+/// Gets the bucket of a value.
+static size_t bucket_of(uint64_t value) {
+  if (value < SUB_BUCKETS) {
+    return (size_t)value;
+  }
+  unsigned int shift = (unsigned int)(63 - __builtin_clzll(value)) - SUB_BITS;
+  return (shift + 1) * SUB_BUCKETS + (size_t)((value >> shift) - SUB_BUCKETS);
+}
+
+/// Gets the largest value counted by a bucket.
+static uint64_t bucket_max(size_t bucket) {
+  if (bucket < SUB_BUCKETS) {
+    return bucket;
+  }
+  unsigned int shift = (unsigned int)(bucket / SUB_BUCKETS - 1);
+  uint64_t low = (uint64_t)(SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+  return low + ((uint64_t)1 << shift) - 1;
+}
+
+/// Gets the stats of the calling thread, registering them on first use.
+static struct ThreadStats* get_thread_stats() {
+  if (thread_stats == NULL) {
+    thread_stats = calloc(1, sizeof(struct ThreadStats));
+    if (thread_stats == NULL) {
+      fprintf(stderr, "Error allocating memory for instrumentation\n");
+      exit(1);
+    }
+    if (pthread_mutex_lock(&stats_lock)) {
+      fprintf(stderr, "Lock Error\n");
+      exit(1);
+    }
+    thread_stats->next = all_stats;
+    all_stats = thread_stats;
+    if (pthread_mutex_unlock(&stats_lock)) {
+      fprintf(stderr, "Lock Error\n");
+      exit(1);
+    }
+  }
+  return thread_stats;
+}
+
+static void add(atomic_ulong* counter, unsigned long value) {
+  atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+void instrument_init() {
+  struct sigaction action = {.sa_handler = request_dump};
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART;
+  sigaction(SIGUSR1, &action, NULL);
+}
+
+uint64_t instrument_now() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+void instrument_record(enum InstrumentPoint point, uint64_t start_ns) {
+  uint64_t elapsed = instrument_now() - start_ns;
+  struct ThreadStats* stats = get_thread_stats();
+  add(&stats->count[point], 1);
+  add(&stats->total_ns[point], elapsed);
+  if (elapsed > atomic_load_explicit(&stats->max_ns[point], memory_order_relaxed)) {
+    atomic_store_explicit(&stats->max_ns[point], elapsed, memory_order_relaxed);
+  }
+  add(&stats->buckets[point][bucket_of(elapsed)], 1);
+
+  if (dump_requested) {
+    dump_requested = 0;
+    instrument_dump();
+  }
+}
+
+void instrument_scope_end(struct InstrumentScope* scope) { instrument_record(scope->point, scope->start_ns); }
+
+/// Gets a percentile of a histogram.
+/// @return Upper bound of the bucket holding the percentile, capped to the largest value, in microseconds.
+static double percentile(unsigned long const* buckets, unsigned long count, unsigned long max_ns, double fraction) {
+  unsigned long rank = (unsigned long)(fraction * (double)count + 0.5);
+  rank = rank > 0 ? rank : 1;
+  unsigned long seen = 0;
+  size_t i = 0;
+  while (i < HISTOGRAM_BUCKETS - 1 && (seen += buckets[i]) < rank) {
+    i++;
+  }
+  uint64_t value = bucket_max(i);
+  return (double)(value < max_ns ? value : max_ns) / 1e3;
+}
+
+void instrument_dump() {
+  static unsigned long buckets[HISTOGRAM_BUCKETS];  // Only used with stats_lock held
+
+  if (pthread_mutex_lock(&stats_lock)) {
+    fprintf(stderr, "Lock Error\n");
+    exit(1);
+  }
+  int header_printed = 0;
+  for (int point = 0; point < INSTR_POINTS; point++) {
+    unsigned long count = 0, total_ns = 0, max_ns = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+      buckets[i] = 0;
+    }
+    for (struct ThreadStats* stats = all_stats; stats != NULL; stats = stats->next) {
+      count += atomic_load_explicit(&stats->count[point], memory_order_relaxed);
+      total_ns += atomic_load_explicit(&stats->total_ns[point], memory_order_relaxed);
+      unsigned long thread_max = atomic_load_explicit(&stats->max_ns[point], memory_order_relaxed);
+      max_ns = thread_max > max_ns ? thread_max : max_ns;
+      for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        buckets[i] += atomic_load_explicit(&stats->buckets[point][i], memory_order_relaxed);
+      }
+    }
+    if (count == 0) {
+      continue;
+    }
+    if (!header_printed) {
+      fprintf(stderr, "Instrumentation of process %ld, times in us\n", (long)getpid());
+      fprintf(stderr, "%-16s %10s %10s %10s %10s %10s %10s %10s\n", "operation", "count", "mean", "p50", "p90",
+              "p99", "p99.9", "max");
+      header_printed = 1;
+    }
+    fprintf(stderr, "%-16s %10lu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", point_names[point], count,
+            (double)total_ns / (double)count / 1e3, percentile(buckets, count, max_ns, 0.5),
+            percentile(buckets, count, max_ns, 0.9), percentile(buckets, count, max_ns, 0.99),
+            percentile(buckets, count, max_ns, 0.999), (double)max_ns / 1e3);
+  }
+  if (pthread_mutex_unlock(&stats_lock)) {
+    fprintf(stderr, "Lock Error\n");
+    exit(1);
+  }
+}
+
+#endif  // EMS_INSTRUMENT
@@ -0,0 +1,75 @@
+#ifndef EMS_INSTRUMENT_H
+#define EMS_INSTRUMENT_H
+
+// Latency instrumentation of the ems_* calls and of the waits on the locks they contend for, only
+// compiled in when EMS_INSTRUMENT is defined (make INSTRUMENT=1). Each thread records into its own
+// counters and log-linear histograms, which are summed when a summary is printed: at ems_terminate,
+// and after SIGUSR1 at the next recorded operation of any thread.
+// Without EMS_INSTRUMENT every macro below compiles to nothing.
+
+enum InstrumentPoint {
+  INSTR_EMS_CREATE,
+  INSTR_EMS_RESERVE,
+  INSTR_EMS_SHOW,
+  INSTR_EMS_LIST,
+  INSTR_EMS_WAIT,
+  INSTR_PARSE,          // Parsing one command in the parser stage
+  INSTR_LIST_LOCK,      // Waiting for the list lock to append an event
+  INSTR_SEAT_LOCK,      // Waiting for a seat lock
+  INSTR_REORDER_LOCK,   // Waiting for the reorder buffer lock, in ordered mode
+  INSTR_PROGRESS_LOCK,  // Waiting for the progress lock of a jobs file, in main.c
+  INSTR_POOL_LOCK,      // Waiting for the worker pool lock, in main.c
+  INSTR_OUTPUT_WRITE,   // Writing buffered output to a file
+  INSTR_WAL_WAIT,       // Waiting for a log record to be durable
+  INSTR_POINTS
+};
+
+#ifdef EMS_INSTRUMENT
+
+#include <stdint.h>
+
+struct InstrumentScope {
+  enum InstrumentPoint point;
+  uint64_t start_ns;
+};
+
+/// Installs the SIGUSR1 handler and clears the recorded operations.
+void instrument_init();
+
+/// Prints the summary of every operation recorded so far to stderr.
+void instrument_dump();
+
+/// Gets the current CLOCK_MONOTONIC time.
+/// @return Time in nanoseconds.
+uint64_t instrument_now();
+
+/// Records an operation of the calling thread.
+/// @param point What the operation was.
+/// @param start_ns Time the operation started, from instrument_now.
+void instrument_record(enum InstrumentPoint point, uint64_t start_ns);
+
+/// Records the operation of a scope when it ends, see INSTRUMENT_SCOPE.
+void instrument_scope_end(struct InstrumentScope* scope);
+
+/// Starts timing an operation, in a variable declared by the macro.
+#define INSTRUMENT_START(var) uint64_t var = instrument_now()
+/// Records an operation started with INSTRUMENT_START.
+#define INSTRUMENT_END(point, var) instrument_record(point, var)
+/// Records the rest of the enclosing scope as an operation, however the scope is left.
+#define INSTRUMENT_SCOPE(point)                                                  \
+  __attribute__((cleanup(instrument_scope_end))) struct InstrumentScope instrument_scope_ = { \
+      point, instrument_now()}
+#define INSTRUMENT_INIT() instrument_init()
+#define INSTRUMENT_DUMP() instrument_dump()
+
+#else
+
+#define INSTRUMENT_START(var)
+#define INSTRUMENT_END(point, var) ((void)(point))  // The point may be a parameter that is otherwise unused
+#define INSTRUMENT_SCOPE(point)
+#define INSTRUMENT_INIT()
+#define INSTRUMENT_DUMP()
+
+#endif  // EMS_INSTRUMENT
+
+#endif  // EMS_INSTRUMENT_H
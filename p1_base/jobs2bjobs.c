@@ -0,0 +1,178 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "binjobs.h"
+#include "constants.h"
+#include "parser.h"
+
+// Converts a jobs file to the binary format read by ems from .bjobs files.
+
+#define USAGE "Usage: jobs2bjobs [-r max_reservation_size] input.jobs [output.bjobs]\n"
+
+/// Writes a whole buffer, resuming after partial writes.
+/// @return 0 if the buffer was written, 1 otherwise.
+static int write_all(int fd, void const* data, size_t len) {
+  char const* bytes = data;
+  while (len > 0) {
+    ssize_t written = write(fd, bytes, len);
+    if (written == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return 1;
+    }
+    bytes += written;
+    len -= (size_t)written;
+  }
+  return 0;
+}
+
+/// Converts every command of a jobs file, skipping the invalid ones.
+/// @return 0 if the file was converted, 1 if the output could not be written.
+static int convert(int in_fd, int out_fd, size_t max) {
+  struct BinaryHeader header = {.version = BINJOBS_VERSION};
+  memcpy(header.magic, BINJOBS_MAGIC, sizeof(header.magic));
+  struct BinaryRecord* record = malloc(binjobs_record_size(max));
+  size_t* xs = malloc(2 * max * sizeof(size_t));
+  if (record == NULL || xs == NULL) {
+    fprintf(stderr, "Failed to allocate memory\n");
+    exit(1);
+  }
+  size_t* ys = xs + max;
+
+  int result = write_all(out_fd, &header, sizeof(header));
+  enum Command command;
+  while (result == 0 && (command = get_next(in_fd)) != EOC) {
+    memset(record, 0, sizeof(*record));
+    size_t num_coords = 0;
+    switch (command) {
+      case CMD_CREATE:
+        if (parse_create(in_fd, &record->event_id, &record->arg0, &record->arg1) != 0) {
+          fprintf(stderr, "Invalid command skipped\n");
+          continue;
+        }
+        record->command = BIN_CREATE;
+        break;
+
+      case CMD_RESERVE:
+        num_coords = parse_reserve(in_fd, max, &record->event_id, xs, ys);
+        if (num_coords == 0) {
+          fprintf(stderr, "Invalid command skipped\n");
+          continue;
+        }
+        record->command = BIN_RESERVE;
+        record->arg0 = num_coords;
+        memcpy(record->coords, xs, num_coords * sizeof(size_t));
+        memcpy(record->coords + num_coords, ys, num_coords * sizeof(size_t));
+        break;
+
+      case CMD_SHOW:
+        if (parse_show(in_fd, &record->event_id) != 0) {
+          fprintf(stderr, "Invalid command skipped\n");
+          continue;
+        }
+        record->command = BIN_SHOW;
+        break;
+
+      case CMD_WAIT: {
+        unsigned int delay, thread_id = 0;
+        if (parse_wait(in_fd, &delay, &thread_id) == -1) {
+          fprintf(stderr, "Invalid command skipped\n");
+          continue;
+        }
+        record->command = BIN_WAIT;
+        record->arg0 = delay;
+        record->arg1 = thread_id;
+        break;
+      }
+
+      case CMD_LIST_EVENTS:
+        record->command = BIN_LIST_EVENTS;
+        break;
+
+      case CMD_BARRIER:
+        record->command = BIN_BARRIER;
+        break;
+
+      case CMD_HELP:
+        record->command = BIN_HELP;
+        break;
+
+      case CMD_INVALID:
+        fprintf(stderr, "Invalid command skipped\n");
+        continue;
+
+      case CMD_EMPTY:
+      case EOC:
+        continue;
+    }
+    result = write_all(out_fd, record, binjobs_record_size(num_coords));
+  }
+
+  release_input(in_fd);
+  free(record);
+  free(xs);
+  return result;
+}
+
+int main(int argc, char* argv[]) {
+  size_t max = MAX_RESERVATION_SIZE;
+  int opt;
+  while ((opt = getopt(argc, argv, "r:")) != -1) {
+    if (opt == 'r') {
+      char* endptr;
+      unsigned long val = strtoul(optarg, &endptr, 10);
+      if (*endptr != '\0' || val == 0 || val > UINT_MAX) {
+        fprintf(stderr, "Invalid max reservation size\n");
+        return 1;
+      }
+      max = (size_t)val;
+    }
+    else {
+      fprintf(stderr, USAGE);
+      return 1;
+    }
+  }
+  if (optind >= argc || argc - optind > 2) {
+    fprintf(stderr, USAGE);
+    return 1;
+  }
+
+  char const* input = argv[optind];
+  char output[PATH_MAX];
+  if (optind + 1 < argc) {
+    snprintf(output, sizeof(output), "%s", argv[optind + 1]);
+  }
+  else {
+    // Same name, with the .jobs extension replaced
+    char const* dot = strrchr(input, '.');
+    int base_len = dot != NULL && strcmp(dot, ".jobs") == 0 ? (int)(dot - input) : (int)strlen(input);
+    snprintf(output, sizeof(output), "%.*s.bjobs", base_len, input);
+  }
+
+  int in_fd = open(input, O_RDONLY);
+  if (in_fd == -1) {
+    fprintf(stderr, "Failed to open %s\n", input);
+    return 1;
+  }
+  int out_fd = open(output, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
+  if (out_fd == -1) {
+    fprintf(stderr, "Failed to open %s\n", output);
+    close(in_fd);
+    return 1;
+  }
+
+  int result = convert(in_fd, out_fd, max);
+  if (result) {
+    fprintf(stderr, "Failed to write %s\n", output);
+  }
+  close(in_fd);
+  close(out_fd);
+  return result;
+}
@@ -9,223 +9,780 @@
 #include <string.h>
 #include <sys/wait.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "binjobs.h"
+#include "commandqueue.h"
 #include "constants.h"
+#include "fiber.h"
+#include "instrument.h"
 #include "operations.h"
+#include "output.h"
 #include "parser.h"
+#include "reorder.h"
 
 #define MAX_PATH_LENGTH 256
 #define ERROR 5
+#define USAGE "Usage: ems [-l seat|row|striped|bit|optimistic] [-c max_fibers] [-o] [-p] [-q access_depth] [-f store_file] [-r max_reservation_size] [-s shared_mb] [-w log_file] [jobs_dir] [max_proc] [max_thr] [delay_ms|<delay_us>us]\n" \
+              "A store alone survives the process dying, not a system crash: add a log for that\n"
 
-int jobs_fd;
-int output_fd;
-int terminate_reading;
-int* wait_times;
-pthread_mutex_t input_lock;
+/// A jobs file being processed, with everything shared by the threads working on it.
+struct JobFile {
+  int jobs_fd;
+  int binary;                    /// Whether the jobs file is a mapped binary jobs file.
+  struct BinaryJobs binary_jobs;
+  int output_fd;
+  struct EmsState* state;        /// Events created by the file.
+  struct CommandQueue queue;     /// Commands parsed and not yet taken by a worker.
+  struct ReorderBuffer reorder;  /// Output waiting for earlier commands, only used in ordered mode.
+
+  // Only accessed by the parser stage
+  unsigned long creates_parsed;
+  unsigned long commands_parsed;
+  unsigned long last_event_write[DEPENDENCY_SLOTS];   /// Commands up to the last change to the events of each slot.
+  unsigned long last_event_access[DEPENDENCY_SLOTS];  /// Commands up to the last change or read of them.
+  unsigned long last_create;
+  unsigned long last_list;
+
+  atomic_ulong creates_done;
+  atomic_ulong commands_done;  /// Commands executed with their output written, only counted in pool mode.
+  atomic_ullong paused_until;  /// CLOCK_MONOTONIC time in ns before which pool workers skip the file.
+  pthread_mutex_t progress_lock;
+  pthread_cond_t create_cond;  /// Signaled when creates_done advances.
+  pthread_cond_t done_cond;    /// Signaled when commands_done advances.
+};
+
+/// Worker pool that runs the commands of every jobs file in pool mode.
+/// Each slot holds the file being processed by one parser thread. Slots are reused by later files, so
+/// workers can scan their queues without any lock.
+struct WorkerPool {
+  struct JobFile* files;    /// Array of max_files slots.
+  int* used;                /// Whether each slot holds a file, protected by lock.
+  size_t max_files;
+  size_t open_files;
+  unsigned int num_workers;
+  int closing;              /// Set once every file has been processed.
+  atomic_ulong generation;  /// Advanced whenever a command is queued, under lock.
+  pthread_mutex_t lock;
+  pthread_cond_t work;       /// Signaled when the generation advances.
+  pthread_cond_t slot_freed;
+};
+
+int ordered_output;
+int pool_mode;
+unsigned int max_fibers = 1;  // Commands each pool worker runs at once, as fibers when more than one
+size_t max_reservation_size = MAX_RESERVATION_SIZE;
+atomic_uint* wait_times;
+struct WorkerPool pool;
 
 typedef struct {
+    struct JobFile* file;
+    pthread_barrier_t* barrier;  /// Where the workers meet at each BARRIER, in fork mode.
     unsigned int thread_id;
     unsigned int max_thr;
 } thr_args;
 
-void * process_line(void* arg) {
-  thr_args const *args = (thr_args const *)arg;
+/// Gets the current CLOCK_MONOTONIC time.
+/// @return Time in nanoseconds.
+static unsigned long long monotonic_ns() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec;
+}
 
-  int *returnValue = malloc(sizeof(int));
-  if (returnValue == NULL) {
-    fprintf(stderr, "Failed to allocate memory for return value");
+/// Acquires a mutex, recording the wait.
+/// @param mutex Mutex to be acquired.
+/// @param point Instrumentation point the wait is recorded under.
+static void lock_mutex(pthread_mutex_t* mutex, enum InstrumentPoint point) {
+  INSTRUMENT_START(start);
+  if (pthread_mutex_lock(mutex)) {
+    fprintf(stderr, "Lock Error\n");
     exit(1);
   }
-  unsigned int thread_id = args->thread_id;
-  unsigned int max_thr = args->max_thr;
-  free(arg);
-  while (1) {
-    unsigned int event_id, delay, thr_id;
-    size_t num_rows, num_columns, num_coords;
-    size_t xs[MAX_RESERVATION_SIZE], ys[MAX_RESERVATION_SIZE];
+  INSTRUMENT_END(point, start);
+}
 
-    if(pthread_mutex_lock(&input_lock)) {
-      fprintf(stderr, "Lock Error\n"); 
-      exit(1);
-    }
-    if (terminate_reading) {
-      if(pthread_mutex_unlock(&input_lock)) {
-        fprintf(stderr, "Lock Error\n"); 
-        exit(1);
-      }
-      *returnValue = 0;
-      return (void *)returnValue;
-    }
-    while (wait_times[thread_id]) {
-      unsigned int wait_time = (unsigned int)wait_times[thread_id];
-      wait_times[thread_id] = 0;
-      if(pthread_mutex_unlock(&input_lock)) {
-        fprintf(stderr, "Lock Error\n"); 
-        exit(1);
-      }
-      ems_wait(wait_time);
-      if(pthread_mutex_lock(&input_lock)) {
-        fprintf(stderr, "Lock Error\n");
-        exit(1);
-      }
+static void unlock_mutex(pthread_mutex_t* mutex) {
+  if (pthread_mutex_unlock(mutex)) {
+    fprintf(stderr, "Lock Error\n");
+    exit(1);
+  }
+}
+
+static void wait_cond(pthread_cond_t* cond, pthread_mutex_t* mutex) {
+  if (pthread_cond_wait(cond, mutex)) {
+    fprintf(stderr, "Lock Error\n");
+    exit(1);
+  }
+}
+
+static void broadcast_cond(pthread_cond_t* cond) {
+  if (pthread_cond_broadcast(cond)) {
+    fprintf(stderr, "Lock Error\n");
+    exit(1);
+  }
+}
+
+/// Waits until the given number of CREATE commands of a file has been executed.
+/// @param file File the commands belong to.
+/// @param count Number of CREATE commands to wait for.
+static void wait_for_creates(struct JobFile* file, unsigned long count) {
+  if (atomic_load(&file->creates_done) >= count) {
+    return;
+  }
+  if (fiber_running()) {
+    // The CREATEs may run on other fibers of this thread
+    while (atomic_load(&file->creates_done) < count) {
+      fiber_yield();
     }
-    switch (get_next(jobs_fd)) {
+    return;
+  }
+  lock_mutex(&file->progress_lock, INSTR_PROGRESS_LOCK);
+  while (atomic_load(&file->creates_done) < count) {
+    wait_cond(&file->create_cond, &file->progress_lock);
+  }
+  unlock_mutex(&file->progress_lock);
+}
+
+/// Marks a CREATE command as executed, releasing the commands that follow it.
+static void finish_create(struct JobFile* file) {
+  lock_mutex(&file->progress_lock, INSTR_PROGRESS_LOCK);
+  atomic_fetch_add(&file->creates_done, 1);
+  broadcast_cond(&file->create_cond);
+  unlock_mutex(&file->progress_lock);
+}
+
+/// Waits until the given number of commands of a file are done, see finish_commands.
+/// @param file File the commands belong to.
+/// @param count Number of commands to wait for.
+static void wait_for_commands(struct JobFile* file, unsigned long count) {
+  lock_mutex(&file->progress_lock, INSTR_PROGRESS_LOCK);
+  while (atomic_load(&file->commands_done) < count) {
+    wait_cond(&file->done_cond, &file->progress_lock);
+  }
+  unlock_mutex(&file->progress_lock);
+}
+
+/// Marks commands of a file as done.
+/// @note Only called once their output has left the worker's buffer, and the worker doesn't touch the
+/// file afterwards: the parser thread may close it as soon as every command is done.
+/// @param file File the commands belong to.
+/// @param count Number of commands.
+static void finish_commands(struct JobFile* file, unsigned long count) {
+  lock_mutex(&file->progress_lock, INSTR_PROGRESS_LOCK);
+  atomic_fetch_add(&file->commands_done, count);
+  broadcast_cond(&file->done_cond);
+  unlock_mutex(&file->progress_lock);
+}
+
+/// Makes pool workers skip the commands of a file for a while.
+/// @param file File to be paused.
+/// @param delay_ms Delay in milliseconds.
+static void pause_file(struct JobFile* file, unsigned int delay_ms) {
+  unsigned long long until = monotonic_ns() + (unsigned long long)delay_ms * 1000000ULL;
+  unsigned long long current = atomic_load(&file->paused_until);
+  while (current < until && !atomic_compare_exchange_weak(&file->paused_until, &current, until)) {
+  }
+}
+
+/// Wakes a pool worker to take a newly queued command.
+static void notify_workers() {
+  lock_mutex(&pool.lock, INSTR_POOL_LOCK);
+  atomic_fetch_add(&pool.generation, 1);
+  if (pthread_cond_signal(&pool.work)) {
+    fprintf(stderr, "Lock Error\n");
+    exit(1);
+  }
+  unlock_mutex(&pool.lock);
+}
+
+/// Numbers a command and, in ordered mode, finds the commands it must run after.
+/// @note Commands conflict when one may change what the other prints: a RESERVE or CREATE with any
+/// earlier command on its event, a SHOW with earlier changes to its event, LIST with earlier CREATEs and
+/// CREATE with earlier LISTs. Events share dependency slots by id, which can only add extra waits.
+/// @param file File the command belongs to.
+/// @param cmd Command about to be queued.
+static void order_command(struct JobFile* file, struct ParsedCommand* cmd) {
+  cmd->seq = file->commands_parsed++;
+  if (!ordered_output) {
+    return;
+  }
+
+  size_t slot = cmd->event_id % DEPENDENCY_SLOTS;
+  unsigned long self = cmd->seq + 1;  // Tables store the number of commands up to the one recorded
+  switch (cmd->command) {
+    case CMD_CREATE:
+      cmd->wait_for = file->last_event_access[slot] > file->last_list ? file->last_event_access[slot] : file->last_list;
+      file->last_event_write[slot] = file->last_event_access[slot] = file->last_create = self;
+      break;
+    case CMD_RESERVE:
+      cmd->wait_for = file->last_event_access[slot];
+      file->last_event_write[slot] = file->last_event_access[slot] = self;
+      break;
+    case CMD_SHOW:
+      cmd->wait_for = file->last_event_write[slot];
+      file->last_event_access[slot] = self;
+      break;
+    case CMD_LIST_EVENTS:
+      cmd->wait_for = file->last_create;
+      file->last_list = self;
+      break;
+    case CMD_WAIT:
+    case CMD_HELP:
+    case CMD_BARRIER:
+    case CMD_INVALID:
+    case CMD_EMPTY:
+    case EOC:
+      break;
+  }
+}
+
+/// Queues a parsed command for the worker threads.
+static void push_command(struct JobFile* file, struct ParsedCommand* cmd) {
+  order_command(file, cmd);
+  queue_push(&file->queue, cmd);
+  if (pool_mode) {
+    notify_workers();
+  }
+}
+
+/// Pushes one copy of a marker per worker thread, so that every worker pops exactly one.
+/// @param file File whose workers get the marker.
+/// @param command Marker to be pushed.
+/// @param max_thr Number of worker threads.
+static void push_markers(struct JobFile* file, enum Command command, unsigned int max_thr) {
+  struct ParsedCommand marker = {.command = command};
+  for (unsigned int i = 0; i < max_thr; i++) {
+    queue_push(&file->queue, &marker);
+  }
+}
+
+/// Parser stage for binary jobs files: records only need checking, RESERVE coordinates are used in place.
+/// @param file File to be read.
+/// @return The command that ended the segment, CMD_BARRIER or EOC.
+static enum Command read_binary_commands(struct JobFile* file) {
+  while (1) {
+    struct ParsedCommand cmd = {.creates_before = file->creates_parsed};
+
+    switch (binjobs_next(&file->binary_jobs, &cmd)) {
       case CMD_CREATE:
-        if (parse_create(jobs_fd, &event_id, &num_rows, &num_columns) != 0) {
+        file->creates_parsed++;
+        push_command(file, &cmd);
+        break;
+
+      case CMD_RESERVE:
+        // Same limit as parse_reserve
+        if (cmd.num_coords >= max_reservation_size) {
           fprintf(stderr, "Invalid command. See HELP for usage\n");
-          *returnValue = 0;
-          return (void *)returnValue;
+          break;
         }
+        push_command(file, &cmd);
+        break;
 
-        if (ems_create(event_id, num_rows, num_columns)) {
-          fprintf(stderr, "Failed to create event\n");
-        }
-        if(pthread_mutex_unlock(&input_lock)) {
-          fprintf(stderr, "Lock Error\n"); 
-          exit(1);
-        }
+      case CMD_SHOW:
+      case CMD_WAIT:
+      case CMD_LIST_EVENTS:
+      case CMD_HELP:
+        push_command(file, &cmd);
+        break;
 
+      case CMD_INVALID:
+        fprintf(stderr, "Invalid command. See HELP for usage\n");
         break;
 
-      case CMD_RESERVE:
-        num_coords = parse_reserve(jobs_fd, MAX_RESERVATION_SIZE, &event_id, xs, ys);
-        if(pthread_mutex_unlock(&input_lock)) {
-          fprintf(stderr, "Lock Error\n"); 
-          exit(1);
-        }
+      case CMD_EMPTY:
+        break;
 
-        if (num_coords == 0) {
-          fprintf(stderr, "Invalid command. See HELP for usage\n");
-          *returnValue = 0;
-          return (void *)returnValue;
-        }
+      case CMD_BARRIER:
+      case EOC:
+        return cmd.command;
+    }
+  }
+}
+
+/// Parser stage: turns a segment of a jobs file into parsed commands for the worker threads.
+/// @param file File to be parsed.
+/// @param xs Scratch array of max_reservation_size rows.
+/// @param ys Scratch array of max_reservation_size columns.
+/// @return The command that ended the segment, CMD_BARRIER or EOC.
+static enum Command parse_commands(struct JobFile* file, size_t* xs, size_t* ys) {
+  if (file->binary) {
+    return read_binary_commands(file);
+  }
+  while (1) {
+    INSTRUMENT_START(start);
+    struct ParsedCommand cmd = {.command = get_next(file->jobs_fd), .creates_before = file->creates_parsed};
 
-        if (ems_reserve(event_id, num_coords, xs, ys)) {
-          fprintf(stderr, "Failed to reserve seats\n");
+    switch (cmd.command) {
+      case CMD_CREATE:
+        if (parse_create(file->jobs_fd, &cmd.event_id, &cmd.num_rows, &cmd.num_cols) != 0) {
+          fprintf(stderr, "Invalid command. See HELP for usage\n");
+          break;
         }
+        file->creates_parsed++;
+        INSTRUMENT_END(INSTR_PARSE, start);
+        push_command(file, &cmd);
         break;
 
-      case CMD_SHOW:
-        if (parse_show(jobs_fd, &event_id) != 0) {
+      case CMD_RESERVE:
+        cmd.num_coords = parse_reserve(file->jobs_fd, max_reservation_size, &cmd.event_id, xs, ys);
+        if (cmd.num_coords == 0) {
           fprintf(stderr, "Invalid command. See HELP for usage\n");
-          *returnValue = 0;
-          return (void *)returnValue;
+          break;
         }
-        if(pthread_mutex_unlock(&input_lock)) {
-          fprintf(stderr, "Lock Error\n"); 
+        // Both coordinate arrays share one allocation sized to the reservation, freed through xs
+        cmd.xs = malloc(2 * cmd.num_coords * sizeof(size_t));
+        if (cmd.xs == NULL) {
+          fprintf(stderr, "Failed to allocate memory for reservation\n");
           exit(1);
         }
+        cmd.ys = cmd.xs + cmd.num_coords;
+        memcpy(cmd.xs, xs, cmd.num_coords * sizeof(size_t));
+        memcpy(cmd.ys, ys, cmd.num_coords * sizeof(size_t));
+        INSTRUMENT_END(INSTR_PARSE, start);
+        push_command(file, &cmd);
+        break;
 
-        if (ems_show(event_id, output_fd)) {
-          fprintf(stderr, "Failed to show event\n");
+      case CMD_SHOW:
+        if (parse_show(file->jobs_fd, &cmd.event_id) != 0) {
+          fprintf(stderr, "Invalid command. See HELP for usage\n");
+          break;
         }
+        INSTRUMENT_END(INSTR_PARSE, start);
+        push_command(file, &cmd);
+        break;
 
+      case CMD_WAIT: {
+        int has_thread = parse_wait(file->jobs_fd, &cmd.delay, &cmd.thread_id);
+        if (has_thread == -1) {
+          fprintf(stderr, "Invalid command. See HELP for usage\n");
+          break;
+        }
+        if (has_thread == 0) {
+          cmd.thread_id = 0;
+        }
+        INSTRUMENT_END(INSTR_PARSE, start);
+        push_command(file, &cmd);
         break;
+      }
 
       case CMD_LIST_EVENTS:
-        if(pthread_mutex_unlock(&input_lock)) {
-          fprintf(stderr, "Lock Error\n"); 
-          exit(1);
-        }
+      case CMD_HELP:
+        INSTRUMENT_END(INSTR_PARSE, start);
+        push_command(file, &cmd);
+        break;
 
-        if (ems_list_events(output_fd)) {
-          fprintf(stderr, "Failed to list events\n");
-        }
+      case CMD_INVALID:
+        fprintf(stderr, "Invalid command. See HELP for usage\n");
+        break;
 
+      case CMD_EMPTY:
         break;
 
-      case CMD_WAIT:
-        if (parse_wait(jobs_fd, &delay, &thr_id) == -1) {
-          fprintf(stderr, "Invalid command. See HELP for usage\n");
-          *returnValue = 0;
-          return (void *)returnValue;
-        }
+      case CMD_BARRIER:
+      case EOC:
+        return cmd.command;
+    }
+  }
+}
 
-        if (delay > 0) {
-          fprintf(stderr, "Waiting...\n");
-          if (thr_id != 0) {
-            wait_times[thr_id] += (int)delay;
-          } 
-          else {
-            for (unsigned int i = 1; i <= max_thr; i++) {
-              wait_times[i] += (int)delay;
-            }
+/// Allocates the scratch coordinate arrays of a parser thread, freed through the returned xs.
+static size_t* alloc_scratch() {
+  size_t *xs = malloc(2 * max_reservation_size * sizeof(size_t));
+  if (xs == NULL) {
+    fprintf(stderr, "Failed to allocate memory for reservation\n");
+    exit(1);
+  }
+  return xs;
+}
+
+/// Executes a command of a file.
+/// @param file File the command belongs to.
+/// @param cmd Command to be executed, anything but a marker.
+/// @param max_thr Number of worker threads WAIT thread ids refer to.
+static void execute_command(struct JobFile* file, struct ParsedCommand* cmd, unsigned int max_thr) {
+  if (cmd->command != CMD_CREATE) {
+    wait_for_creates(file, cmd->creates_before);
+  }
+  if (ordered_output) {
+    reorder_wait(&file->reorder, cmd->wait_for);
+  }
+
+  switch (cmd->command) {
+    case CMD_CREATE:
+      // CREATEs run in file order, so a command never sees an event created after it
+      wait_for_creates(file, cmd->creates_before);
+      if (ems_create(file->state, cmd->event_id, cmd->num_rows, cmd->num_cols)) {
+        fprintf(stderr, "Failed to create event\n");
+      }
+      finish_create(file);
+      break;
+
+    case CMD_RESERVE:
+      if (ems_reserve(file->state, cmd->event_id, cmd->num_coords, cmd->xs, cmd->ys)) {
+        fprintf(stderr, "Failed to reserve seats\n");
+      }
+      if (!file->binary) {
+        free(cmd->xs);
+      }
+      break;
+
+    case CMD_SHOW:
+      if (ems_show(file->state, cmd->event_id, file->output_fd)) {
+        fprintf(stderr, "Failed to show event\n");
+      }
+      break;
+
+    case CMD_LIST_EVENTS:
+      if (ems_list_events(file->state, file->output_fd)) {
+        fprintf(stderr, "Failed to list events\n");
+      }
+      break;
+
+    case CMD_WAIT:
+      if (cmd->delay > 0) {
+        fprintf(stderr, "Waiting...\n");
+        if (cmd->thread_id != 0) {
+          if (cmd->thread_id <= max_thr) {
+            atomic_fetch_add(&wait_times[cmd->thread_id], cmd->delay);
           }
         }
-        if(pthread_mutex_unlock(&input_lock)) {
-          fprintf(stderr, "Lock Error\n"); 
-          exit(1);
+        else if (pool_mode) {
+          // Only this file waits, the pool keeps running the others
+          pause_file(file, cmd->delay);
         }
-        break;
+        else {
+          for (unsigned int i = 1; i <= max_thr; i++) {
+            atomic_fetch_add(&wait_times[i], cmd->delay);
+          }
+        }
+      }
+      break;
 
-      case CMD_INVALID:
-      if(pthread_mutex_unlock(&input_lock)) {
-      fprintf(stderr, "Lock Error\n"); 
-      exit(1);
-    };
-        fprintf(stderr, "Invalid command. See HELP for usage\n");
-        break;
+    case CMD_HELP: {
+      char* commands =  "Available commands:\n"
+                        "  CREATE <event_id> <num_rows> <num_columns>\n"
+                        "  RESERVE <event_id> [(<x1>,<y1>) (<x2>,<y2>) ...]\n"
+                        "  SHOW <event_id>\n"
+                        "  LIST\n"
+                        "  WAIT <delay_ms> [thread_id]\n"
+                        "  BARRIER\n"
+                        "  HELP\n";
+      output_write(file->output_fd, commands, strlen(commands));
+      break;
+    }
 
-      case CMD_HELP: {
-        if(pthread_mutex_unlock(&input_lock)) {
-          fprintf(stderr, "Lock Error\n"); 
-          exit(1);
-        }
-        char* commands =  "Available commands:\n"
-                          "  CREATE <event_id> <num_rows> <num_columns>\n"
-                          "  RESERVE <event_id> [(<x1>,<y1>) (<x2>,<y2>) ...]\n"
-                          "  SHOW <event_id>\n"
-                          "  LIST\n"
-                          "  WAIT <delay_ms> [thread_id]\n"
-                          "  BARRIER\n"
-                          "  HELP\n";
-        write(output_fd, commands, strlen(commands));
+    case CMD_INVALID:
+    case CMD_EMPTY:
+    case CMD_BARRIER:
+    case EOC:
+      // Never queued by the parser stage, markers are handled by the workers
+      break;
+  }
+}
+
+/// Hands the output of an executed command to the reorder buffer of its file, in ordered mode.
+static void complete_ordered(struct JobFile* file, struct ParsedCommand const* cmd) {
+  size_t len;
+  char* output = output_take(&len);
+  reorder_complete(&file->reorder, cmd->seq, output, len);
+}
+
+/// Sleeps for the WAITs addressed to a worker thread.
+static void wait_for_thread(unsigned int thread_id) {
+  unsigned int wait_time;
+  while ((wait_time = atomic_exchange(&wait_times[thread_id], 0)) != 0) {
+    ems_wait(wait_time);
+  }
+}
+
+/// Parser thread of a file in fork mode.
+/// Pushes one marker for each worker at every BARRIER and at the end of the file.
+void * read_commands(void* arg) {
+  thr_args const *args = (thr_args const *)arg;
+  size_t *xs = alloc_scratch();
+
+  enum Command end;
+  do {
+    end = parse_commands(args->file, xs, xs + max_reservation_size);
+    push_markers(args->file, end, args->max_thr);
+  } while (end == CMD_BARRIER);
+  free(xs);
+  return NULL;
+}
+
+/// Waits for every worker of a file to reach a BARRIER.
+/// @note A worker that popped a marker can't pop another before the others arrive, so each worker
+/// takes exactly one. Delays added for a worker after it popped its marker are dropped, as they were
+/// when the workers exited at each BARRIER: one worker clears them while the others wait again.
+static void wait_at_barrier(pthread_barrier_t* barrier, unsigned int max_thr) {
+  int result = pthread_barrier_wait(barrier);
+  if (result == PTHREAD_BARRIER_SERIAL_THREAD) {
+    for (unsigned int i = 1; i <= max_thr; i++) {
+      atomic_store(&wait_times[i], 0);
+    }
+  }
+  else if (result != 0) {
+    fprintf(stderr, "Barrier Error\n");
+    exit(1);
+  }
+  result = pthread_barrier_wait(barrier);
+  if (result != 0 && result != PTHREAD_BARRIER_SERIAL_THREAD) {
+    fprintf(stderr, "Barrier Error\n");
+    exit(1);
+  }
+}
+
+/// Worker thread of a file in fork mode, which runs until the end of the file.
+void * process_line(void* arg) {
+  thr_args const *args = (thr_args const *)arg;
+
+  struct JobFile* file = args->file;
+  unsigned int thread_id = args->thread_id;
+  unsigned int max_thr = args->max_thr;
+  if (ordered_output) {
+    output_hold(1);
+  }
+  while (1) {
+    wait_for_thread(thread_id);
+
+    struct ParsedCommand cmd;
+    queue_pop(&file->queue, &cmd);
+    if (cmd.command == CMD_BARRIER || cmd.command == EOC) {
+      // Output from before the marker must reach the file before any from after it
+      output_flush();
+      if (cmd.command == EOC) {
+        return NULL;
+      }
+      wait_at_barrier(args->barrier, max_thr);
+      continue;
+    }
+
+    execute_command(file, &cmd, max_thr);
+    if (ordered_output) {
+      complete_ordered(file, &cmd);
+    }
+  }
+}
+
+/// Takes the next command of any file in pool mode, waiting while there is none.
+/// @note Scans the files from the given one, so a worker sticks to its file while it has commands and
+/// only steals from the others when it runs out. Flushes the worker's output before waiting.
+/// @param start Slot to scan from.
+/// @param file Pointer to the variable to store the file of the command in.
+/// @param cmd Pointer to the variable to store the command in.
+/// @param current Pointer to the file whose output the worker has buffered, NULL if none.
+/// @param unflushed Pointer to the number of commands of current whose output is buffered.
+/// @param until CLOCK_MONOTONIC time in ns to stop waiting at, ULLONG_MAX to wait for as long as it takes.
+/// @return 0 if a command was taken, 1 if every file has been processed, 2 if there was none until then.
+static int take_command(size_t start, struct JobFile** file, struct ParsedCommand* cmd,
+                        struct JobFile** current, unsigned long* unflushed, unsigned long long until) {
+  while (1) {
+    unsigned long generation = atomic_load(&pool.generation);
+    unsigned long long now = monotonic_ns();
+    unsigned long long wake = ULLONG_MAX;  // Time the first paused file resumes
+    for (size_t i = 0; i < pool.max_files; i++) {
+      struct JobFile* candidate = &pool.files[(start + i) % pool.max_files];
+      unsigned long long paused_until = atomic_load(&candidate->paused_until);
+      if (paused_until > now) {
+        wake = paused_until < wake ? paused_until : wake;
+        continue;
+      }
+      if (queue_trypop(&candidate->queue, cmd) == 0) {
+        *file = candidate;
+        return 0;
+      }
+    }
+
+    if (*unflushed > 0) {
+      output_flush();
+      finish_commands(*current, *unflushed);
+      *unflushed = 0;
+      continue;  // Flushing may have let a barrier through
+    }
+    if (now >= until) {
+      return 2;
+    }
+    wake = until < wake ? until : wake;
+
+    lock_mutex(&pool.lock, INSTR_POOL_LOCK);
+    while (atomic_load(&pool.generation) == generation && !pool.closing) {
+      if (wake == ULLONG_MAX) {
+        wait_cond(&pool.work, &pool.lock);
+        continue;
+      }
+      struct timespec deadline = {(time_t)(wake / 1000000000ULL), (long)(wake % 1000000000ULL)};
+      int result = pthread_cond_timedwait(&pool.work, &pool.lock, &deadline);
+      if (result == ETIMEDOUT) {
         break;
       }
+      if (result) {
+        fprintf(stderr, "Lock Error\n");
+        exit(1);
+      }
+    }
+    int closing = pool.closing;
+    unlock_mutex(&pool.lock);
+    if (closing) {
+      return 1;
+    }
+  }
+}
 
-      case CMD_BARRIER:
-        terminate_reading = 1;
-        *returnValue = 1;
-        if(pthread_mutex_unlock(&input_lock)) {
-          fprintf(stderr, "Lock Error\n"); 
-          exit(1);
-        }
-        return (void *)returnValue;
+/// Output of the commands a pool worker runs as fibers, see fiber_worker.
+struct FiberWorker {
+  struct JobFile* current;  /// File whose output the worker has buffered, NULL if none.
+  unsigned long unflushed;  /// Number of commands of current whose output is buffered.
+};
 
-      case CMD_EMPTY:
-        if(pthread_mutex_unlock(&input_lock)) {
-          fprintf(stderr, "Lock Error\n"); 
-          exit(1);
-        }
+/// Command run on a fiber of a pool worker.
+struct FiberCommand {
+  struct FiberWorker* worker;
+  struct JobFile* file;
+  struct ParsedCommand cmd;
+};
+
+/// Runs a command on a fiber, then accounts for its output like pool_worker does.
+/// @note A command's output is buffered after its last wait, so the worker's buffer only ever holds the
+/// output of commands that have ended.
+static void run_fiber_command(void* arg) {
+  struct FiberCommand* command = arg;
+  struct FiberWorker* worker = command->worker;
+  struct JobFile* file = command->file;
+
+  execute_command(file, &command->cmd, pool.num_workers);
+  if (ordered_output) {
+    complete_ordered(file, &command->cmd);
+    finish_commands(file, 1);
+  }
+  else {
+    if (file != worker->current && worker->unflushed > 0) {
+      output_flush();
+      finish_commands(worker->current, worker->unflushed);
+      worker->unflushed = 0;
+    }
+    worker->current = file;
+    worker->unflushed++;
+  }
+  free(command);
+}
+
+/// Worker thread of the pool that runs up to max_fibers commands at once, each on a fiber of its own.
+/// @note Commands switch to each other whenever one waits on the state, a seat lock or an earlier
+/// command, so their delays overlap. A command stays on the worker that took it until it ends.
+/// @param thread_id Id of the worker.
+static void * fiber_worker(unsigned int thread_id) {
+  struct FiberWorker worker = {.current = NULL, .unflushed = 0};
+  if (fibers_init(max_fibers)) {
+    fprintf(stderr, "Failed to allocate memory for fibers\n");
+    exit(1);
+  }
+
+  size_t start = thread_id % pool.max_files;
+  while (1) {
+    if (atomic_load(&wait_times[thread_id]) != 0 && worker.unflushed > 0) {
+      output_flush();
+      finish_commands(worker.current, worker.unflushed);
+      worker.unflushed = 0;
+    }
+    wait_for_thread(thread_id);
+
+    unsigned long long due = fibers_run();
+    if (fibers_in_flight() == max_fibers) {
+      fibers_wait(due);
+      continue;
+    }
+
+    // Only wait for new commands until the next fiber is due
+    struct FiberCommand* command = malloc(sizeof(struct FiberCommand));
+    if (command == NULL) {
+      fprintf(stderr, "Failed to allocate memory for a command\n");
+      exit(1);
+    }
+    int result = take_command(start, &command->file, &command->cmd, &worker.current, &worker.unflushed,
+                              fibers_in_flight() > 0 ? due : ULLONG_MAX);
+    if (result != 0) {
+      free(command);
+      if (result == 1) {
         break;
+      }
+      if (due == 0) {
+        fibers_wait(due);  // Only commands polling for others are in flight
+      }
+      continue;
+    }
+    command->worker = &worker;
+    start = (size_t)(command->file - pool.files);
+    fiber_start(run_fiber_command, command);
+  }
 
-      case EOC:
-        terminate_reading = 1;
-        *returnValue = 0;
-        if(pthread_mutex_unlock(&input_lock)) {
-          fprintf(stderr, "Lock Error\n"); 
-          exit(1);
-        }
-        return (void *)returnValue;
+  fibers_destroy();
+  return NULL;
+}
+
+/// Worker thread of the pool.
+void * pool_worker(void* arg) {
+  unsigned int thread_id = *(unsigned int const *)arg;
+  free(arg);
+  if (ordered_output) {
+    output_hold(1);
+  }
+  if (max_fibers > 1) {
+    return fiber_worker(thread_id);
+  }
+
+  struct JobFile* current = NULL;
+  unsigned long unflushed = 0;
+  size_t start = thread_id % pool.max_files;
+  while (1) {
+    if (atomic_load(&wait_times[thread_id]) != 0 && unflushed > 0) {
+      output_flush();
+      finish_commands(current, unflushed);
+      unflushed = 0;
+    }
+    wait_for_thread(thread_id);
+
+    struct JobFile* file;
+    struct ParsedCommand cmd;
+    if (take_command(start, &file, &cmd, &current, &unflushed, ULLONG_MAX)) {
+      return NULL;
+    }
+    if (file != current && unflushed > 0) {
+      output_flush();
+      finish_commands(current, unflushed);
+      unflushed = 0;
+    }
+    current = file;
+    start = (size_t)(file - pool.files);
+
+    execute_command(file, &cmd, pool.num_workers);
+    if (ordered_output) {
+      complete_ordered(file, &cmd);
+      finish_commands(file, 1);
+    }
+    else {
+      unflushed++;
     }
   }
 }
 
-int openJobsFile(const char *dirpath, const char *filename) {
+int openJobsFile(struct JobFile* file, const char *dirpath, const char *filename) {
     char file_path[MAX_PATH_LENGTH];
     snprintf(file_path, sizeof(file_path), "%s/%s", dirpath, filename);
 
-    jobs_fd = open(file_path, O_RDONLY);
-    if (jobs_fd == -1) {
+    file->jobs_fd = open(file_path, O_RDONLY);
+    if (file->jobs_fd == -1) {
       return 1;
     }
     return 0;
 }
 
-int openOutputFile(const char *dirpath, const char *filename) {
+int openOutputFile(struct JobFile* file, const char *dirpath, const char *filename) {
     char output_file_path[MAX_PATH_LENGTH];
-    snprintf(output_file_path, sizeof(output_file_path), "%s/%.*sout", dirpath, (int)(strlen(filename) - 4), filename);
-    output_fd = open(output_file_path, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
-    if (output_fd == -1) {
+    int base_len = (int)(strrchr(filename, '.') - filename) + 1;
+    snprintf(output_file_path, sizeof(output_file_path), "%s/%.*sout", dirpath, base_len, filename);
+    file->output_fd = open(output_file_path, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
+    if (file->output_fd == -1) {
       return 1;
     }
     return 0;
@@ -243,82 +800,343 @@ int parseValue(unsigned int *value, const char *arg) {
     return 0;
 }
 
+/// Parses a state access delay, in milliseconds or, with a "us" suffix, in microseconds.
+/// @param delay_us Pointer to store the delay in microseconds in.
+/// @param arg Delay to be parsed, 0 for none.
+/// @return 0 if the delay was parsed successfully, 1 otherwise.
+int parseDelay(unsigned int *delay_us, const char *arg) {
+    char *endptr;
+    unsigned long int val = strtoul(arg, &endptr, 10);
+    unsigned long int scale = 1000;
+
+    if (strcmp(endptr, "us") == 0) {
+        scale = 1;
+    } else if (strcmp(endptr, "ms") != 0 && *endptr != '\0') {
+        return 1;
+    }
+    if (endptr == arg || val > UINT_MAX / scale) {
+        return 1;
+    }
+
+    *delay_us = (unsigned int)(val * scale);
+    return 0;
+}
+
+static int has_extension(const char *filename, const char *extension) {
+    size_t len = strlen(filename), ext_len = strlen(extension);
+    return len >= ext_len && strcmp(filename + len - ext_len, extension) == 0;
+}
+
+/// Checks whether a file is not a jobs file, either in text (.jobs) or in binary (.bjobs).
 int is_jobs_file(const char *filename) {
-    return !(strlen(filename) >= 5 && strcmp(filename + strlen(filename) - 5, ".jobs") == 0);
+    return !(has_extension(filename, ".jobs") || has_extension(filename, ".bjobs"));
 }
 
-int init_globals(unsigned int max_thr, const char *dirpath, const char *filename) {
-  if(pthread_mutex_init(&input_lock, NULL)) {
+/// Initializes the parts of a file slot that outlive the files processed in it.
+int init_job_file(struct JobFile* file) {
+  if (pthread_mutex_init(&file->progress_lock, NULL) || pthread_cond_init(&file->create_cond, NULL) ||
+      pthread_cond_init(&file->done_cond, NULL)) {
     fprintf(stderr, "Mutex initialization failed\n");
     return 1;
   }
-  wait_times = (int*)malloc((max_thr + 1) * sizeof(int));
-  if (wait_times == NULL) {
-    fprintf(stderr, "Failed to initialize wait_times\n");
+  if (queue_init(&file->queue, COMMAND_QUEUE_SIZE)) {
+    fprintf(stderr, "Failed to initialize command queue\n");
     return 1;
   }
-  if (openJobsFile(dirpath, filename)) {
+  atomic_init(&file->paused_until, 0);
+  return 0;
+}
+
+void destroy_job_file(struct JobFile* file) {
+  queue_destroy(&file->queue);
+  if (pthread_mutex_destroy(&file->progress_lock) || pthread_cond_destroy(&file->create_cond) ||
+      pthread_cond_destroy(&file->done_cond)) {
+    fprintf(stderr, "Lock Error\n");
+    exit(1);
+  }
+}
+
+/// Closes the jobs file itself, unmapping it if it is binary.
+static void close_jobs_input(struct JobFile* file) {
+  if (file->binary) {
+    binjobs_close(&file->binary_jobs);
+  }
+  else {
+    release_input(file->jobs_fd);
+  }
+  close(file->jobs_fd);
+}
+
+/// Opens a jobs file in an initialized slot.
+int open_job_file(struct JobFile* file, const char *dirpath, const char *filename) {
+  file->creates_parsed = 0;
+  file->commands_parsed = 0;
+  file->last_create = file->last_list = 0;
+  memset(file->last_event_write, 0, sizeof(file->last_event_write));
+  memset(file->last_event_access, 0, sizeof(file->last_event_access));
+  atomic_store(&file->creates_done, 0);
+  atomic_store(&file->commands_done, 0);
+  atomic_store(&file->paused_until, 0);
+  if (openJobsFile(file, dirpath, filename)) {
     fprintf(stderr, "Failed to open jobs file\n");
     return 1;
   }
-  if (openOutputFile(dirpath, filename)) {
+  file->binary = has_extension(filename, ".bjobs");
+  if (file->binary && binjobs_open(&file->binary_jobs, file->jobs_fd)) {
+    fprintf(stderr, "Invalid binary jobs file\n");
+    close(file->jobs_fd);
+    return 1;
+  }
+  if (openOutputFile(file, dirpath, filename)) {
     fprintf(stderr, "Failed to open output file\n");
+    close_jobs_input(file);
+    return 1;
+  }
+  if (ordered_output && reorder_init(&file->reorder, file->output_fd, REORDER_BUFFER_SIZE)) {
+    fprintf(stderr, "Failed to initialize reorder buffer\n");
+    close_jobs_input(file);
+    close(file->output_fd);
+    return 1;
+  }
+  file->state = ems_state_create();
+  if (file->state == NULL) {
+    fprintf(stderr, "Failed to create EMS state\n");
+    if (ordered_output) {
+      reorder_destroy(&file->reorder);
+    }
+    close_jobs_input(file);
+    close(file->output_fd);
     return 1;
   }
   return 0;
 }
 
-void terminate_globals() {
-  free(wait_times);
-  if(pthread_mutex_destroy(&input_lock)) {
-    fprintf(stderr, "Lock Error\n"); 
-    exit(1);
+/// Closes a jobs file, once every one of its commands is done.
+void close_job_file(struct JobFile* file) {
+  ems_state_destroy(file->state);
+  if (ordered_output) {
+    reorder_destroy(&file->reorder);
   }
+  close_jobs_input(file);
+  close(file->output_fd);
 }
 
-int process_file(unsigned int max_thr) {
+int process_file(struct JobFile* file, unsigned int max_thr) {
     pthread_t th[max_thr];
-    int barrier_found = 1;
-    while (barrier_found) {
-      terminate_reading = 0;
-      barrier_found = 0;
-      for (unsigned int i = 0; i < max_thr; i++) {
-        wait_times[i + 1] = 0;
-      }
-      for (unsigned int i = 0; i < max_thr; i++) {
-        thr_args *args = malloc(sizeof(thr_args));
-        if (args == NULL) {
-          fprintf(stderr, "Failed to allocate memory for thread_id");
+    thr_args args[max_thr];
+    pthread_t parser;
+    pthread_barrier_t barrier;
+    thr_args parser_args = {.file = file, .max_thr = max_thr};
+    if (pthread_barrier_init(&barrier, NULL, max_thr > 0 ? max_thr : 1)) {
+      fprintf(stderr, "Failed to initialize barrier\n");
+      return 1;
+    }
+    if (pthread_create(&parser, NULL, read_commands, &parser_args) != 0) {
+        fprintf(stderr, "Failed to create thread");
+        return 1;
+    }
+    for (unsigned int i = 0; i < max_thr; i++) {
+      atomic_init(&wait_times[i + 1], 0);
+      args[i] = (thr_args){.file = file, .barrier = &barrier, .thread_id = i + 1, .max_thr = max_thr};
+      if (pthread_create(&th[i], NULL, process_line, &args[i]) != 0) {
+          fprintf(stderr, "Failed to create thread");
           return 1;
-        }
-        args->thread_id = i+1;
-        args->max_thr = max_thr;
-        if (pthread_create(&th[i], NULL, process_line, args) != 0) {
-            fprintf(stderr, "Failed to create thread");
-            return 1;
-        }
       }
-      void * status = 0;
-      for (unsigned int i = 0; i < max_thr; i++) {
-        if (pthread_join(th[i], &status) != 0) {
-            fprintf(stderr, "Failed to create thread");
-            return 1;
-        }
-        if (*((int*)status) == 1) {
-          barrier_found = 1;
-        }
-        free(status);
+    }
+    if (pthread_join(parser, NULL) != 0) {
+        fprintf(stderr, "Failed to join thread");
+        return 1;
+    }
+    for (unsigned int i = 0; i < max_thr; i++) {
+      if (pthread_join(th[i], NULL) != 0) {
+          fprintf(stderr, "Failed to join thread");
+          return 1;
       }
     }
+    if (pthread_barrier_destroy(&barrier)) {
+      fprintf(stderr, "Barrier Error\n");
+      return 1;
+    }
     return 0;
 }
 
+/// Processes a jobs file in its own process, with max_thr worker threads.
+int process_file_forked(unsigned int max_thr, const char *dirpath, const char *filename) {
+  struct JobFile* file = malloc(sizeof(struct JobFile));
+  wait_times = malloc((max_thr + 1) * sizeof(atomic_uint));
+  if (file == NULL || wait_times == NULL) {
+    fprintf(stderr, "Failed to initialize wait_times\n");
+    return 1;
+  }
+  if (init_job_file(file)) {
+    return 1;
+  }
+  if (open_job_file(file, dirpath, filename)) {
+    destroy_job_file(file);
+    free(file);
+    free(wait_times);
+    return 1;
+  }
+  if (process_file(file, max_thr)) {
+    return 1;
+  }
+  close_job_file(file);
+  destroy_job_file(file);
+  free(file);
+  free(wait_times);
+  return 0;
+}
+
+/// Parser thread of a file in pool mode, which also closes the file and frees its slot.
+/// BARRIERs don't stop the workers: the parser waits for the commands before it to be done.
+void * run_job_file(void* arg) {
+  struct JobFile* file = arg;
+  size_t *xs = alloc_scratch();
+
+  enum Command end;
+  do {
+    end = parse_commands(file, xs, xs + max_reservation_size);
+    wait_for_commands(file, file->commands_parsed);
+  } while (end == CMD_BARRIER);
+  free(xs);
+  close_job_file(file);
+
+  lock_mutex(&pool.lock, INSTR_POOL_LOCK);
+  pool.used[file - pool.files] = 0;
+  pool.open_files--;
+  if (pthread_cond_signal(&pool.slot_freed)) {
+    fprintf(stderr, "Lock Error\n");
+    exit(1);
+  }
+  unlock_mutex(&pool.lock);
+  return NULL;
+}
+
+/// Starts the worker pool.
+/// @param max_files Number of files processed at the same time.
+/// @param num_workers Number of worker threads.
+/// @param workers Array of num_workers threads to store the workers in.
+int start_pool(size_t max_files, unsigned int num_workers, pthread_t* workers) {
+  pthread_condattr_t attr;
+  if (pthread_mutex_init(&pool.lock, NULL) || pthread_condattr_init(&attr) ||
+      pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) || pthread_cond_init(&pool.work, &attr) ||
+      pthread_cond_init(&pool.slot_freed, NULL) || pthread_condattr_destroy(&attr)) {
+    fprintf(stderr, "Mutex initialization failed\n");
+    return 1;
+  }
+  pool.files = malloc(max_files * sizeof(struct JobFile));
+  pool.used = calloc(max_files, sizeof(int));
+  wait_times = malloc((num_workers + 1) * sizeof(atomic_uint));
+  if (pool.files == NULL || pool.used == NULL || wait_times == NULL) {
+    fprintf(stderr, "Failed to allocate memory for the worker pool\n");
+    return 1;
+  }
+  pool.max_files = max_files;
+  pool.open_files = 0;
+  pool.num_workers = num_workers;
+  pool.closing = 0;
+  atomic_init(&pool.generation, 0);
+  for (size_t i = 0; i < max_files; i++) {
+    if (init_job_file(&pool.files[i])) {
+      return 1;
+    }
+  }
+
+  for (unsigned int i = 0; i < num_workers; i++) {
+    atomic_init(&wait_times[i + 1], 0);
+    unsigned int *thread_id = malloc(sizeof(unsigned int));
+    if (thread_id == NULL) {
+      fprintf(stderr, "Failed to allocate memory for thread_id");
+      return 1;
+    }
+    *thread_id = i + 1;
+    if (pthread_create(&workers[i], NULL, pool_worker, thread_id) != 0) {
+      fprintf(stderr, "Failed to create thread");
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/// Waits for every open file to be processed, then stops the worker pool.
+int stop_pool(pthread_t* workers) {
+  lock_mutex(&pool.lock, INSTR_POOL_LOCK);
+  while (pool.open_files > 0) {
+    wait_cond(&pool.slot_freed, &pool.lock);
+  }
+  pool.closing = 1;
+  broadcast_cond(&pool.work);
+  unlock_mutex(&pool.lock);
+
+  for (unsigned int i = 0; i < pool.num_workers; i++) {
+    if (pthread_join(workers[i], NULL) != 0) {
+      fprintf(stderr, "Failed to join thread");
+      return 1;
+    }
+  }
+  for (size_t i = 0; i < pool.max_files; i++) {
+    destroy_job_file(&pool.files[i]);
+  }
+  free(pool.files);
+  free(pool.used);
+  free(wait_times);
+  if (pthread_mutex_destroy(&pool.lock) || pthread_cond_destroy(&pool.work) || pthread_cond_destroy(&pool.slot_freed)) {
+    fprintf(stderr, "Lock Error\n");
+    exit(1);
+  }
+  return 0;
+}
+
+/// Processes every jobs file of a directory in this process, on one pool of max_proc * max_thr workers.
+/// @note Up to max_proc files are parsed at the same time, each by its own parser thread.
+int process_directory_pooled(DIR *dirp, const char *dirpath, unsigned int max_proc, unsigned int max_thr) {
+  size_t max_files = max_proc > 0 ? max_proc : 1;
+  unsigned int num_workers = (max_proc > 0 ? max_proc : 1) * (max_thr > 0 ? max_thr : 1);
+  pthread_t workers[num_workers];
+  if (start_pool(max_files, num_workers, workers)) {
+    return 1;
+  }
+
+  struct dirent *dp;
+  while ((dp = readdir(dirp)) != NULL) {
+    if (is_jobs_file(dp->d_name))
+      continue;
+
+    lock_mutex(&pool.lock, INSTR_POOL_LOCK);
+    while (pool.open_files == pool.max_files) {
+      wait_cond(&pool.slot_freed, &pool.lock);
+    }
+    size_t slot = 0;
+    while (pool.used[slot]) {
+      slot++;
+    }
+    unlock_mutex(&pool.lock);
+
+    struct JobFile* file = &pool.files[slot];
+    if (open_job_file(file, dirpath, dp->d_name)) {
+      continue;
+    }
+    lock_mutex(&pool.lock, INSTR_POOL_LOCK);
+    pool.used[slot] = 1;
+    pool.open_files++;
+    unlock_mutex(&pool.lock);
+
+    pthread_t parser;
+    if (pthread_create(&parser, NULL, run_job_file, file) != 0 || pthread_detach(parser) != 0) {
+      fprintf(stderr, "Failed to create thread");
+      return 1;
+    }
+  }
+  return stop_pool(workers);
+}
+
 void wait_for_children() {
     while (wait(NULL) > 0);
 }
 
 int main(int argc, char *argv[]) {
-  unsigned int state_access_delay_ms = STATE_ACCESS_DELAY_MS;
+  struct EmsOptions options = {
+      .delay_us = STATE_ACCESS_DELAY_MS * 1000, .access_depth = 1, .seat_lock_mode = SEAT_LOCK_SEAT};
   const char *dirpath = "jobs";
   DIR *dirp;
   unsigned int max_proc = 0;
@@ -326,15 +1144,78 @@ int main(int argc, char *argv[]) {
   struct dirent *dp;
   pid_t pid = 1;
   unsigned int num_proc = 0;
+  int opt;
 
+  while ((opt = getopt(argc, argv, "c:f:l:opq:r:s:w:")) != -1) {
+    switch (opt) {
+      case 'c':
+        // Fibers run on the worker pool
+        if (parseValue(&max_fibers, optarg) || max_fibers > MAX_FIBERS) {
+          fprintf(stderr, "Invalid max fibers, expected 1 to %d\n", MAX_FIBERS);
+          return 1;
+        }
+        pool_mode = 1;
+        break;
+      case 'o':
+        ordered_output = 1;
+        break;
+      case 'p':
+        pool_mode = 1;
+        break;
+      case 'f':
+        // The store and the log are used by a single process, so their jobs files run on the worker pool
+        options.store_path = optarg;
+        pool_mode = 1;
+        break;
+      case 'w':
+        options.log_path = optarg;
+        pool_mode = 1;
+        break;
+      case 'q':
+        if (parseValue(&options.access_depth, optarg) || options.access_depth > STATE_DELAY_MAX_DEPTH) {
+          fprintf(stderr, "Invalid access depth, expected 1 to %d\n", STATE_DELAY_MAX_DEPTH);
+          return 1;
+        }
+        break;
+      case 'r': {
+        unsigned int size;
+        if (parseValue(&size, optarg)) {
+          fprintf(stderr, "Invalid max reservation size or value too large\n");
+          return 1;
+        }
+        max_reservation_size = size;
+        break;
+      }
+      case 's': {
+        unsigned int size_mb;
+        if (parseValue(&size_mb, optarg)) {
+          fprintf(stderr, "Invalid shared memory size or value too large\n");
+          return 1;
+        }
+        options.shared_size = (size_t)size_mb << 20;
+        break;
+      }
+      case 'l':
+        if (parse_seat_lock_mode(optarg, &options.seat_lock_mode)) {
+          fprintf(stderr, "Invalid seat lock mode, expected seat, row, striped, bit or optimistic\n");
+          return 1;
+        }
+        break;
+      default:
+        fprintf(stderr, USAGE);
+        return 1;
+    }
+  }
+  argc -= optind - 1;
+  argv += optind - 1;
 
   if (argc > 1) {
     dirpath = argv[1];
-    dirp = opendir(dirpath);
-    if (dirp == NULL) {
-      fprintf(stderr, "Open dir failed\n");
-      return 1;
-    }
+  }
+  dirp = opendir(dirpath);
+  if (dirp == NULL) {
+    fprintf(stderr, "Open dir failed\n");
+    return 1;
   }
   if (argc > 2) {
     if (parseValue(&max_proc, argv[2])) {
@@ -349,16 +1230,23 @@ int main(int argc, char *argv[]) {
     }
   }
   if (argc > 4) {
-    if (parseValue(&state_access_delay_ms, argv[4])) {
+    if (parseDelay(&options.delay_us, argv[4])) {
       fprintf(stderr, "Invalid delay value or value too large\n");
       return 1;
     }
   }
-  if (ems_init(state_access_delay_ms)) {
+  if (ems_init(&options)) {
     fprintf(stderr, "Failed to initialize EMS\n");
     return 1;
   }
 
+  if (pool_mode) {
+    int result = process_directory_pooled(dirp, dirpath, max_proc, max_thr);
+    ems_terminate();
+    closedir(dirp);
+    return result;
+  }
+
   while (1) {
     errno = 0;
     dp = readdir(dirp);
@@ -381,13 +1269,9 @@ int main(int argc, char *argv[]) {
   }
 
   if (pid == 0) {
-    if (init_globals(max_thr, dirpath, dp->d_name)){
+    if (process_file_forked(max_thr, dirpath, dp->d_name)) {
       exit(1);
     }
-    if(process_file(max_thr)) {
-      exit(1);
-    }
-    terminate_globals();
   }
   else {
     wait_for_children();
@@ -395,4 +1279,4 @@ int main(int argc, char *argv[]) {
   ems_terminate();
   closedir(dirp);
   return 0;
-}
\ No newline at end of file
+}
@@ -1,45 +1,109 @@
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <time.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <unistd.h>
 #include <string.h>
 #include <limits.h>
 
 #include "eventlist.h"
+#include "fiber.h"
+#include "instrument.h"
+#include "operations.h"
+#include "output.h"
+#include "parking.h"
+#include "seatformat.h"
+#include "statedelay.h"
+#include "statemem.h"
+#include "store.h"
+#include "wal.h"
+
+/// Events of a venue database.
+struct EmsState {
+  struct EventList* events;
+};
+
+static int initialized = 0;
+static struct EmsState* common_state = NULL;  // State of every jobs file in shared, store and log modes
+static pthread_mutex_t create_log_lock = PTHREAD_MUTEX_INITIALIZER;  // Orders logged CREATEs, see ems_create
+static enum SeatLockMode seat_lock_mode = SEAT_LOCK_SEAT;
+
+#define SEAT_PENDING UINT_MAX  // Seat claimed by an optimistic reservation that hasn't committed yet
+#define SEAT_COMMITTING 0x80000000u  // Marks the id of a reservation still committing to the store, see commit_seats
+#define MAX_RESERVATION_ID (SEAT_COMMITTING - 2)  // So that no marked id is SEAT_PENDING
+#define LIST_LINE_SIZE 19      // "Event: <id>\n" for the largest id, plus the terminator
+
+/// Scratch buffers reused by the SHOWs of a thread, freed when the thread exits.
+struct ShowBuffers {
+  void* seats;       /// Snapshot of the seats.
+  size_t seats_size;
+};
+
+static pthread_key_t show_buffers_key;
+
+static void free_show_buffers(void* arg) {
+  struct ShowBuffers* buffers = arg;
+  free(buffers->seats);
+  free(buffers);
+}
 
-pthread_mutex_t output_lock;
-static struct EventList* event_list = NULL;
-static unsigned int state_access_delay_ms = 0;
+/// Gets the scratch buffers of the calling thread.
+static struct ShowBuffers* get_show_buffers() {
+  struct ShowBuffers* buffers = pthread_getspecific(show_buffers_key);
+  if (buffers == NULL) {
+    buffers = calloc(1, sizeof(struct ShowBuffers));
+    if (buffers == NULL || pthread_setspecific(show_buffers_key, buffers)) {
+      fprintf(stderr, "Error allocating memory for show buffers\n");
+      exit(1);
+    }
+  }
+  return buffers;
+}
 
-/// Calculates a timespec from a delay in milliseconds.
-/// @param delay_ms Delay in milliseconds.
-/// @return Timespec with the given delay.
-static struct timespec delay_to_timespec(unsigned int delay_ms) {
-  return (struct timespec){delay_ms / 1000, (delay_ms % 1000) * 1000000};
+/// Makes a scratch buffer at least the given size.
+/// @param buffer Pointer to the buffer, reallocated if too small.
+/// @param size Pointer to the current size of the buffer.
+/// @param min_size Size needed.
+/// @return The buffer.
+static void* grow_buffer(void** buffer, size_t* size, size_t min_size) {
+  if (*size < min_size) {
+    void* grown = realloc(*buffer, min_size);
+    if (grown == NULL) {
+      fprintf(stderr, "Error allocating memory for show buffers\n");
+      exit(1);
+    }
+    *buffer = grown;
+    *size = min_size;
+  }
+  return *buffer;
 }
 
 /// Gets the event with the given ID from the state.
-/// @note Will wait to simulate a real system accessing a costly memory resource.
+/// @note Will wait to simulate a real system accessing a costly memory resource (see statedelay.h).
+/// @param state State to get the event from.
 /// @param event_id The ID of the event to get.
 /// @return Pointer to the event if found, NULL otherwise.
-static struct Event* get_event_with_delay(unsigned int event_id) {
-  struct timespec delay = delay_to_timespec(state_access_delay_ms);
-  nanosleep(&delay, NULL);  // Should not be removed
+static struct Event* get_event_with_delay(struct EmsState* state, unsigned int event_id) {
+  state_delay_access();  // Should not be removed
 
-  return get_event(event_list, event_id);
+  return get_event(state->events, event_id);
 }
 
-/// Gets the seat with the given index from the state.
-/// @note Will wait to simulate a real system accessing a costly memory resource.
-/// @param event Event to get the seat from.
-/// @param index Index of the seat to get.
-/// @return Pointer to the seat.
-static unsigned int* get_seat_with_delay(struct Event* event, size_t index) {
-  struct timespec delay = delay_to_timespec(state_access_delay_ms);
-  nanosleep(&delay, NULL);  // Should not be removed
-
-  return &event->data[index];
+/// Gets the length of the batch that starts at the first of a list of seats.
+/// @note A batch is a run of consecutive seats in the same row, which the state fetches in a single access.
+/// @param event Event the seats belong to.
+/// @param indexes Array of seat indexes sorted in ascending order.
+/// @param num_seats Number of seats in the array.
+/// @return Number of seats at the start of the array that form a batch.
+static size_t seat_run(struct Event* event, size_t const* indexes, size_t num_seats) {
+  size_t run = 1;
+  while (run < num_seats && indexes[run] == indexes[0] + run && indexes[run] % event->cols != 0) {
+    run++;
+  }
+  return run;
 }
 
 /// Gets the index of a seat.
@@ -50,335 +114,753 @@ static unsigned int* get_seat_with_delay(struct Event* event, size_t index) {
 /// @return Index of the seat.
 static size_t seat_index(struct Event* event, size_t row, size_t col) { return (row - 1) * event->cols + col - 1; }
 
-int ems_init(unsigned int delay_ms) {
-  if (event_list != NULL) {
-    fprintf(stderr, "EMS state has already been initialized\n");
-    return 1;
+/// Finishes the reservations the process was committing to the seats of a stored event when it died.
+/// @note Seats still claimed by an optimistic reservation were never committed, so they are freed. A
+/// reservation marks every seat before writing its id to any (see commit_seats): once a seat holds the
+/// id, it is rolled forward, otherwise it may be missing seats and is rolled back.
+/// @param event Event whose seats were loaded from the store.
+/// @return Largest reservation id in the seats.
+static unsigned int recover_stored_seats(struct Event* event) {
+  size_t num_seats = event->rows * event->cols;
+  unsigned int reservations = 0;
+  for (size_t i = 0; i < num_seats; i++) {
+    unsigned int seat = atomic_load_explicit(&event->data[i], memory_order_relaxed);
+    if (seat == SEAT_PENDING) {
+      seat = 0;
+      atomic_store_explicit(&event->data[i], seat, memory_order_relaxed);
+    }
+    else if (seat & SEAT_COMMITTING) {
+      // The seats before this one are finished already, so every seat with its mark lies from here on
+      unsigned int id = seat & ~SEAT_COMMITTING;
+      int committed = 0;
+      for (size_t j = 0; j < num_seats && !committed; j++) {
+        committed = atomic_load_explicit(&event->data[j], memory_order_relaxed) == id;
+      }
+      for (size_t j = i; j < num_seats; j++) {
+        if (atomic_load_explicit(&event->data[j], memory_order_relaxed) == seat) {
+          atomic_store_explicit(&event->data[j], committed ? id : 0, memory_order_relaxed);
+        }
+      }
+      seat = committed ? id : 0;
+    }
+    reservations = seat > reservations ? seat : reservations;
   }
-  if (pthread_mutex_init(&output_lock, NULL)) {
-    fprintf(stderr, "Lock Error\n");
-    exit(1);
+  return reservations;
+}
+
+/// Creates an event, without adding it to any state.
+/// @param events List the event is allocated for, see list_alloc_event.
+/// @param event_id Id of the event.
+/// @param num_rows Number of rows of the event.
+/// @param num_cols Number of columns of the event.
+/// @param stored_data Seats of the event in the persistent store, NULL to allocate them free.
+/// @return The new event, NULL on failure.
+static struct Event* new_event(struct EventList* events, unsigned int event_id, size_t num_rows, size_t num_cols,
+                               atomic_uint* stored_data) {
+  // The seats follow the event in the same block, unless the store has them
+  struct Event* event = list_alloc_event(events, stored_data != NULL ? 0 : num_rows * num_cols);
+
+  if (event == NULL) {
+    fprintf(stderr, "Error allocating memory for event\n");
+    return NULL;
   }
-  event_list = create_list();
-  state_access_delay_ms = delay_ms;
 
-  return event_list == NULL;
-}
+  event->id = event_id;
+  event->rows = num_rows;
+  event->cols = num_cols;
+  atomic_init(&event->reservations, 0);
+  atomic_init(&event->committing, 0);
+  atomic_init(&event->seat_version, 0);
+  event->stored = stored_data != NULL;
+  if (event->stored) {
+    event->data = stored_data;
+  }
 
-int ems_terminate() {
-  if (event_list == NULL) {
-    fprintf(stderr, "EMS state must be initialized\n");
-    return 1;
+  if (seatlocks_init(&event->seatlocks, seat_lock_mode, num_rows, num_cols)) {
+    fprintf(stderr, "Error allocating memory for event data\n");
+    list_discard_event(events, event);
+    return NULL;
   }
-  free_list(event_list);
-  if (pthread_mutex_destroy(&output_lock)) {
-    fprintf(stderr, "Lock Error\n");
-    exit(1);
+
+  if (event->stored) {
+    // Reservation ids keep counting from the last one that made it to the seats
+    atomic_store_explicit(&event->reservations, recover_stored_seats(event), memory_order_relaxed);
+  }
+  else {
+    for (size_t i = 0; i < num_rows * num_cols; i++) {
+      atomic_init(&event->data[i], 0);
+    }
+  }
+  return event;
+}
+
+/// Rebuilds the events of the persistent store in a state, without paying the state access delay.
+/// @return 0 if every event was loaded, 1 otherwise.
+static int load_store(struct EmsState* state) {
+  size_t offset = 0;
+  unsigned int event_id;
+  size_t num_rows, num_cols;
+  atomic_uint* seats;
+  while ((seats = store_next_event(&offset, &event_id, &num_rows, &num_cols)) != NULL) {
+    struct Event* event = new_event(state->events, event_id, num_rows, num_cols, seats);
+    if (event == NULL || append_to_list(state->events, event) != 0) {
+      fprintf(stderr, "Error loading event %u from the store\n", event_id);
+      return 1;
+    }
   }
   return 0;
 }
 
-int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols) {
+/// Applies a record of the log to a state, without paying the state access delay.
+/// @note Records already reflected in the state, by the persistent store, change nothing.
+static void replay_entry(struct WalEntry const* entry, void* arg) {
+  struct EmsState* state = arg;
+  struct Event* event = get_event(state->events, entry->event_id);
 
-  if (event_list == NULL) {
-    fprintf(stderr, "EMS state must be initialized\n");
-    return 1;
+  if (entry->type == WAL_CREATE) {
+    if (event != NULL) {
+      return;
+    }
+    atomic_uint* stored_data = store_enabled() ? store_add_event(entry->event_id, entry->rows, entry->cols) : NULL;
+    event = new_event(state->events, entry->event_id, entry->rows, entry->cols, stored_data);
+    if (event == NULL || append_to_list(state->events, event) != 0) {
+      fprintf(stderr, "Error replaying the creation of event %u\n", entry->event_id);
+      return;
+    }
+    if (stored_data != NULL) {
+      store_commit_event(stored_data);
+    }
+    return;
   }
 
-  if (get_event_with_delay(event_id) != NULL) {
-    fprintf(stderr, "Event already exists\n");
-    return 1;
+  if (event == NULL) {
+    return;
   }
-  struct Event* event = malloc(sizeof(struct Event));
+  for (size_t i = 0; i < entry->num_seats; i++) {
+    if (entry->seats[i] < event->rows * event->cols) {
+      atomic_store_explicit(&event->data[entry->seats[i]], entry->reservation_id, memory_order_relaxed);
+    }
+  }
+  if (entry->reservation_id > atomic_load_explicit(&event->reservations, memory_order_relaxed)) {
+    atomic_store_explicit(&event->reservations, entry->reservation_id, memory_order_relaxed);
+  }
+}
 
-  if (event == NULL) {
-    fprintf(stderr, "Error allocating memory for event\n");
+int ems_init(struct EmsOptions const *options) {
+  if (initialized) {
+    fprintf(stderr, "EMS state has already been initialized\n");
     return 1;
   }
+  if (pthread_key_create(&show_buffers_key, free_show_buffers)) {
+    fprintf(stderr, "Error creating show buffers\n");
+    return 1;
+  }
+  state_delay_init(options->delay_us, options->access_depth);
+  seat_lock_mode = options->seat_lock_mode;
+  initialized = 1;
+  INSTRUMENT_INIT();
 
-  event->id = event_id;
-  event->rows = num_rows;
-  event->cols = num_cols;
-  event->reservations = 0;
-  event->data = malloc(num_rows * num_cols * sizeof(unsigned int));
-  event->seatlocks = malloc (num_rows * num_cols * sizeof(pthread_rwlock_t));
-
-  if (pthread_rwlock_init(&event->event_lock, NULL)) {
-    fprintf(stderr, "Lock Error\n");
-    exit(1);
+  if (options->shared_size > 0 && options->store_path != NULL) {
+    fprintf(stderr, "The shared memory region and the persistent store can't be used together\n");
+    return 1;
   }
-  if (pthread_mutex_init(&event->reservation_lock, NULL)) {
-    fprintf(stderr, "Lock Error\n");
-    exit(1);
+  if (options->shared_size > 0) {
+    if (statemem_share(options->shared_size)) {
+      fprintf(stderr, "Error mapping shared memory\n");
+      return 1;
+    }
+    common_state = ems_state_create();
+    if (common_state == NULL) {
+      return 1;
+    }
   }
-
-  if (event->data == NULL) {
-    fprintf(stderr, "Error allocating memory for event data\n");
-    free(event);
+  if (options->store_path != NULL) {
+    if (store_open(options->store_path)) {
+      fprintf(stderr, "Error opening the store\n");
+      return 1;
+    }
+    common_state = ems_state_create();
+    if (common_state == NULL || load_store(common_state)) {
+      return 1;
+    }
+  }
+  if (parking_init()) {
+    fprintf(stderr, "Error creating the parking buckets\n");
     return 1;
   }
+  if (options->log_path != NULL) {
+    if (options->shared_size > 0) {
+      fprintf(stderr, "The shared memory region and the log can't be used together\n");
+      return 1;
+    }
+    if (wal_open(options->log_path)) {
+      fprintf(stderr, "Error opening the log\n");
+      return 1;
+    }
+    if (common_state == NULL) {
+      common_state = ems_state_create();
+    }
+    if (common_state == NULL || wal_replay(replay_entry, common_state)) {
+      fprintf(stderr, "Error replaying the log\n");
+      return 1;
+    }
+  }
+  return 0;
+}
 
-  if (event->seatlocks == NULL) {
-    fprintf(stderr, "Error allocating memory for event data\n");
-    free(event);
+int ems_terminate() {
+  if (!initialized) {
+    fprintf(stderr, "EMS state must be initialized\n");
     return 1;
   }
+  INSTRUMENT_DUMP();
+  if (!statemem_shared() || statemem_owner()) {
+    parking_destroy();
+  }
+  if (common_state != NULL) {
+    // Processes forked with the state only drop their mapping, the one that created it destroys it
+    struct EmsState* state = common_state;
+    common_state = NULL;
+    if (!statemem_shared() || statemem_owner()) {
+      ems_state_destroy(state);
+    }
+    statemem_unshare();
+    if (store_enabled()) {
+      // Once the seats are written back, the store holds everything the log does
+      store_close();
+      if (wal_enabled()) {
+        wal_truncate();
+      }
+    }
+    wal_close();
+  }
+  pthread_key_delete(show_buffers_key);
+  initialized = 0;
+  return 0;
+}
+
+struct EmsState* ems_state_create() {
+  if (!initialized) {
+    fprintf(stderr, "EMS state must be initialized\n");
+    return NULL;
+  }
+  if (common_state != NULL) {
+    return common_state;
+  }
+  struct EmsState* state = state_alloc(sizeof(struct EmsState));
+  if (state == NULL) {
+    return NULL;
+  }
+  state->events = create_list();
+  if (state->events == NULL) {
+    state_free(state);
+    return NULL;
+  }
+  return state;
+}
 
-  for (size_t i = 0; i < num_rows * num_cols; i++) {
-    event->data[i] = 0;
-    if (pthread_rwlock_init(&event->seatlocks[i], NULL)) {
-      fprintf(stderr, "Lock Error\n");
-      exit(1);
+void ems_state_destroy(struct EmsState* state) {
+  if (state == common_state) {
+    return;
+  }
+  free_list(state->events);
+  state_free(state);
+}
+
+/// Allocates a new event of a state, and its record in the persistent store if there is one.
+/// @note The event stays invisible until publish_event.
+/// @return The event, NULL on failure.
+static struct Event* prepare_event(struct EmsState* state, unsigned int event_id, size_t num_rows, size_t num_cols) {
+  atomic_uint* stored_data = NULL;
+  if (store_enabled()) {
+    stored_data = store_add_event(event_id, num_rows, num_cols);
+    if (stored_data == NULL) {
+      fprintf(stderr, "Error adding event to the store\n");
+      return NULL;
     }
   }
+  return new_event(state->events, event_id, num_rows, num_cols, stored_data);
+}
+
+/// Gives back an event that was prepared and not published.
+/// @note Its record in the persistent store is never committed, so the store ignores it.
+static void discard_event(struct EmsState* state, struct Event* event) {
+  seatlocks_destroy(&event->seatlocks);
+  list_discard_event(state->events, event);
+}
 
-  if (append_to_list(event_list, event) != 0) {
+/// Makes a prepared event visible, and commits it to the persistent store if there is one.
+/// @return 0 if the event was published successfully, 1 otherwise, in which case it is discarded.
+static int publish_event(struct EmsState* state, struct Event* event) {
+  if (append_to_list(state->events, event) != 0) {
     fprintf(stderr, "Error appending event to list\n");
-    free(event->data);
-    free(event);
+    discard_event(state, event);
     return 1;
   }
+  if (event->stored) {
+    store_commit_event(event->data);
+  }
   return 0;
 }
 
-
-int bubble_sort_seats(size_t arr1[], size_t arr2[], size_t n) {
-    for (size_t i = 0; i < n - 1; ++i) {
-        size_t swapped = 0; // Flag to check if any elements are swapped
-        for (size_t j = 0; j < n - i - 1; ++j) {
-            // Swap adjacent elements if they are in the wrong order
-            if (arr1[j] > arr1[j + 1]) {
-                size_t temp = arr1[j];
-                arr1[j] = arr1[j + 1];
-                arr1[j + 1] = temp;
-
-                temp = arr2[j];
-                arr2[j] = arr2[j + 1];
-                arr2[j + 1] = temp;
-                swapped = 1; // Set swapped flag if a swap occurs
-            }
-            else if (arr1[j] == arr1[j + 1]) {
-              if (arr2[j] == arr2[j + 1]) {
-                return 1;
-              }
-              if (arr2[j] > arr2[j + 1]) {
-                size_t temp = arr2[j];
-                arr2[j] = arr2[j + 1];
-                arr2[j + 1] = temp;
-                swapped = 1; // Set swapped flag if a swap occurs
-              }
-            }
-        }
-        // If no two elements were swapped in the inner loop, array is sorted
-        if (swapped == 0) {
-            break;
-        }
+/// Acquires create_log_lock.
+/// @note Its holder waits for the log, which yields its fiber (see wal_wait), so a fiber polls for the
+/// lock rather than block the thread the holder may be waiting to run on.
+static void lock_create_log() {
+  int result;
+  if (fiber_running()) {
+    while ((result = pthread_mutex_trylock(&create_log_lock)) == EBUSY) {
+      fiber_yield();
     }
-    return 0;
+  } else {
+    result = pthread_mutex_lock(&create_log_lock);
+  }
+  if (result) {
+    fprintf(stderr, "Lock Error\n");
+    exit(1);
+  }
 }
 
+int ems_create(struct EmsState* state, unsigned int event_id, size_t num_rows, size_t num_cols) {
+  INSTRUMENT_SCOPE(INSTR_EMS_CREATE);
 
-int ems_reserve(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys) {
-
-  if (event_list == NULL) {
+  if (state == NULL) {
     fprintf(stderr, "EMS state must be initialized\n");
     return 1;
   }
 
-  struct Event* event = get_event_with_delay(event_id);
-
-  if (event == NULL) {
-    fprintf(stderr, "Event not found\n");
+  if (get_event_with_delay(state, event_id) != NULL) {
+    fprintf(stderr, "Event already exists\n");
     return 1;
   }
 
-  if(bubble_sort_seats(xs, ys, num_seats)) {
-    fprintf(stderr, "Seat already reserved\n");
-    return 1;
+  if (!wal_enabled()) {
+    struct Event* event = prepare_event(state, event_id, num_rows, num_cols);
+    return event != NULL ? publish_event(state, event) : 1;
   }
 
-  size_t i = 0;
-  int can_reserve = 1;
-  for (; i < num_seats; i++) {
-    size_t row = xs[i];
-    size_t col = ys[i];
-
-    if (row <= 0 || row > event->rows || col <= 0 || col > event->cols) {
-      can_reserve = 0;
-      fprintf(stderr, "Invalid seat\n");
-      break;
+  // With a log, CREATEs are serialized so that only the one that adds the event is logged. Everything
+  // that can fail is done before the record is written, and the event only becomes visible once the
+  // record is durable, so nothing acts on a CREATE that a crash would undo and the record comes before
+  // the records of any reservation on the event
+  lock_create_log();
+  int result = 1;
+  if (get_event(state->events, event_id) != NULL) {
+    fprintf(stderr, "Event already exists\n");
+  }
+  else {
+    struct Event* event = prepare_event(state, event_id, num_rows, num_cols);
+    if (event != NULL && list_reserve(state->events) != 0) {
+      discard_event(state, event);
+      event = NULL;
     }
-    if (pthread_rwlock_wrlock(&event->seatlocks[seat_index(event, xs[i], ys[i])])) {
-      fprintf(stderr, "Lock Error\n");
-      exit(1);
+    if (event != NULL) {
+      wal_wait(wal_log_create(event_id, num_rows, num_cols));
+      result = publish_event(state, event);
     }
-    if (*get_seat_with_delay(event, seat_index(event, row, col)) != 0) {
-      if (pthread_rwlock_unlock(&event->seatlocks[seat_index(event, xs[i], ys[i])])) {
-        fprintf(stderr, "Lock Error\n");
-        exit(1);
+  }
+  if (pthread_mutex_unlock(&create_log_lock)) {
+    fprintf(stderr, "Lock Error\n");
+    exit(1);
+  }
+  return result;
+}
+
+
+/// Sorts seat indexes in ascending order.
+/// @note Runs in linear time: an LSD radix sort on as many bytes as the largest index needs, with an
+/// insertion sort for the small reservations where that is cheaper.
+/// @param indexes Array of seat indexes to be sorted.
+/// @param scratch Array of the same size used as temporary storage.
+/// @param n Number of indexes.
+/// @param max_index Largest possible index.
+static void sort_seat_indexes(size_t* indexes, size_t* scratch, size_t n, size_t max_index) {
+  if (n <= 32) {
+    for (size_t i = 1; i < n; i++) {
+      size_t index = indexes[i];
+      size_t j = i;
+      for (; j > 0 && indexes[j - 1] > index; j--) {
+        indexes[j] = indexes[j - 1];
       }
-      can_reserve = 0;
-      fprintf(stderr, "Seat already reserved\n");
-      break;
+      indexes[j] = index;
     }
+    return;
   }
-  if (can_reserve) {
-    if (pthread_mutex_lock(&event->reservation_lock)) {
-      fprintf(stderr, "Lock Error\n");
-      exit(1);
+
+  size_t* from = indexes;
+  size_t* to = scratch;
+  for (unsigned int shift = 0; shift < 8 * sizeof(size_t) && (max_index >> shift) != 0; shift += 8) {
+    size_t counts[256] = {0};
+    for (size_t i = 0; i < n; i++) {
+      counts[(from[i] >> shift) & 0xff]++;
     }
-    unsigned int reservation_id = ++event->reservations;
-    if (pthread_mutex_unlock(&event->reservation_lock)) {
-      fprintf(stderr, "Lock Error\n");
-      exit(1);
+    size_t total = 0;
+    for (size_t digit = 0; digit < 256; digit++) {
+      size_t count = counts[digit];
+      counts[digit] = total;
+      total += count;
     }
-    for (size_t j = 0; j < num_seats; j++) {
-      size_t row = xs[j];
-      size_t col = ys[j];
-      *get_seat_with_delay(event, seat_index(event, row, col)) = reservation_id;
-      if (pthread_rwlock_unlock(&event->seatlocks[seat_index(event, row, col)])) {
-        fprintf(stderr, "Lock Error\n");
-        exit(1);
-      }
+    for (size_t i = 0; i < n; i++) {
+      to[counts[(from[i] >> shift) & 0xff]++] = from[i];
+    }
+    size_t* temp = from;
+    from = to;
+    to = temp;
+  }
+  if (from != indexes) {
+    memcpy(indexes, from, n * sizeof(size_t));
+  }
+}
+
+/// Gets a new reservation id for an event.
+/// @return The id, 0 if the event has run out of them.
+static unsigned int next_reservation_id(struct Event* event) {
+  // Ids only need to be unique, the seats they are written to are published by commit_seats
+  unsigned int last = atomic_load_explicit(&event->reservations, memory_order_relaxed);
+  do {
+    if (last >= MAX_RESERVATION_ID) {
+      return 0;
     }
+  } while (!atomic_compare_exchange_weak_explicit(&event->reservations, &last, last + 1, memory_order_relaxed,
+                                                  memory_order_relaxed));
+  return last + 1;
+}
+
+/// Pays the state access delay of a set of seats, fetching them batch by batch.
+/// @note Every batch is issued before any is waited for, so their delays overlap up to the access depth.
+/// @param event Event the seats belong to.
+/// @param indexes Array of seat indexes sorted in ascending order.
+/// @param num_seats Number of seats.
+static void fetch_seats_with_delay(struct Event* event, size_t const* indexes, size_t num_seats) {
+  unsigned long last = 0;
+  for (size_t i = 0; i < num_seats;) {
+    last = state_delay_issue();
+    i += seat_run(event, indexes + i, num_seats - i);
+  }
+  state_delay_wait(last);
+}
+
+/// Fetch of the batches of a set of seats that are used one after the other.
+/// @note Batches after the one in use are issued while there is room in the access depth, so their
+/// delay overlaps with the wait for the earlier ones.
+struct SeatFetch {
+  struct Event* event;
+  size_t const* indexes;  /// Seat indexes sorted in ascending order.
+  size_t num_seats;
+  size_t issued;          /// Number of seats whose batch has been issued.
+  size_t fetched;         /// Number of seats whose batch has been returned by next_seat_batch.
+  unsigned long ticket;   /// Ticket of the first batch not returned yet, those after it are consecutive.
+};
+
+/// Starts fetching the batches of a set of seats.
+static void begin_seat_fetch(struct SeatFetch* fetch, struct Event* event, size_t const* indexes, size_t num_seats) {
+  *fetch = (struct SeatFetch){.event = event, .indexes = indexes, .num_seats = num_seats};
+}
+
+/// Waits for the next batch of a fetch.
+/// @note Batches left in flight when the caller stops early complete on their own.
+/// @param fetch Fetch to get the batch of.
+/// @param first Pointer to store the position of the first seat of the batch in the indexes in.
+/// @return Number of seats of the batch, 0 once every batch has been returned.
+static size_t next_seat_batch(struct SeatFetch* fetch, size_t* first) {
+  if (fetch->fetched == fetch->num_seats) {
     return 0;
   }
-  else {
-    for (size_t j = 0; j < i; j++) {
-      size_t row = xs[j];
-      size_t col = ys[j];
-      if (pthread_rwlock_unlock(&event->seatlocks[seat_index(event, row, col)])) {
-        fprintf(stderr, "Lock Error\n");
-        exit(1);
+  // Issuing beyond the depth would wait for the batch about to be used, so it ends the lookahead
+  while (fetch->issued < fetch->num_seats && (fetch->issued == fetch->fetched || state_delay_can_issue())) {
+    unsigned long ticket = state_delay_issue();
+    if (fetch->issued == fetch->fetched) {
+      fetch->ticket = ticket;
+    }
+    fetch->issued += seat_run(fetch->event, fetch->indexes + fetch->issued, fetch->num_seats - fetch->issued);
+  }
+  state_delay_wait(fetch->ticket++);
+
+  *first = fetch->fetched;
+  size_t run = seat_run(fetch->event, fetch->indexes + fetch->fetched, fetch->num_seats - fetch->fetched);
+  fetch->fetched += run;
+  return run;
+}
+
+/// Writes a reservation id to its seats.
+/// @note The seats must have been fetched already, so the commit only spans the memory stores. With a
+/// log, the reservation is logged and waited for first, together with concurrent ones (see wal.h).
+/// Readers that overlap it retry, so they never see part of a reservation (see read_seats_snapshot).
+/// @param event Event the seats belong to.
+/// @param indexes Array of seat indexes.
+/// @param num_seats Number of seats.
+/// @param reservation_id Id to be written.
+static void commit_seats(struct Event* event, size_t const* indexes, size_t num_seats, unsigned int reservation_id) {
+  if (wal_enabled()) {
+    // Readers only see a reservation once its record is durable
+    wal_wait(wal_log_reserve(event->id, reservation_id, indexes, num_seats));
+  }
+  atomic_fetch_add(&event->committing, 1);
+  if (event->stored && !wal_enabled()) {
+    // Nothing else would tell a crash apart from a partial reservation, so every seat is marked before
+    // the id is written to any (see recover_stored_seats)
+    for (size_t i = 0; i < num_seats; i++) {
+      atomic_store_explicit(&event->data[indexes[i]], SEAT_COMMITTING | reservation_id, memory_order_release);
+    }
+  }
+  for (size_t i = 0; i < num_seats; i++) {
+    atomic_store_explicit(&event->data[indexes[i]], reservation_id, memory_order_release);
+  }
+  atomic_fetch_add(&event->seat_version, 1);
+  atomic_fetch_sub(&event->committing, 1);
+  if (seat_lock_mode == SEAT_LOCK_OPTIMISTIC) {
+    // Overlapping reservations may be parked on the seats while they were pending (see claim_seat)
+    for (size_t i = 0; i < num_seats; i++) {
+      unpark(&event->data[indexes[i]]);
+    }
+  }
+}
+
+/// Checks whether a seat is still pending, see park.
+static int seat_pending(void const* seat) { return atomic_load((atomic_uint const*)seat) == SEAT_PENDING; }
+
+/// Claims a free seat for an optimistic reservation, waiting while another one holds it pending.
+/// @param seat Seat to be claimed.
+/// @return 1 if the seat was claimed, 0 if it is reserved.
+static int claim_seat(atomic_uint* seat) {
+  unsigned int expected = 0;
+  while (!atomic_compare_exchange_weak(seat, &expected, SEAT_PENDING)) {
+    if (expected != 0 && expected != SEAT_PENDING) {
+      return 0;
+    }
+    if (expected == SEAT_PENDING) {
+      // The reservation holding it may sleep through the state access delay before it commits or
+      // rolls back, so park until then rather than spin
+      park(seat, seat_pending, seat);
+    }
+    expected = 0;
+  }
+  return 1;
+}
+
+/// Reserves seats without locks, claiming each one with compare-and-swap.
+/// @note Seats are claimed in ascending order and a seat claimed by an uncommitted reservation is
+/// waited for, so overlapping reservations resolve as if run one after the other while disjoint
+/// ones never wait for each other.
+/// @param event Event to reserve the seats in.
+/// @param num_seats Number of seats to reserve.
+/// @param indexes Indexes of the seats, sorted in ascending order.
+/// @return 0 if the reservation was created successfully, 1 otherwise.
+static int reserve_optimistic(struct Event* event, size_t num_seats, size_t const* indexes) {
+  struct SeatFetch fetch;
+  begin_seat_fetch(&fetch, event, indexes, num_seats);
+  size_t claimed = 0, first, run;
+  int conflict = 0;
+  while (!conflict && (run = next_seat_batch(&fetch, &first)) > 0) {
+    atomic_uint* seats = &event->data[indexes[first]];
+    for (size_t i = 0; i < run && !conflict; i++) {
+      if (claim_seat(&seats[i])) {
+        claimed++;
+      } else {
+        conflict = 1;
       }
     }
+  }
+
+  unsigned int reservation_id = conflict ? 0 : next_reservation_id(event);
+  if (reservation_id == 0) {
+    for (size_t i = 0; i < claimed; i++) {
+      atomic_store_explicit(&event->data[indexes[i]], 0, memory_order_release);
+      unpark(&event->data[indexes[i]]);
+    }
+    fprintf(stderr, conflict ? "Seat already reserved\n" : "Too many reservations\n");
     return 1;
   }
+
+  fetch_seats_with_delay(event, indexes, num_seats);
+  commit_seats(event, indexes, num_seats, reservation_id);
+  return 0;
 }
 
-int ems_show(unsigned int event_id, int fd) {
-  if (event_list == NULL) {
+/// Releases the locks acquired by ems_reserve.
+static void unlock_seats(struct Event* event, size_t const* lock_ids, size_t num_locks) {
+  for (size_t i = 0; i < num_locks; i++) {
+    seatlock_unlock(&event->seatlocks, lock_ids[i]);
+  }
+}
+
+int ems_reserve(struct EmsState* state, unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys) {
+  INSTRUMENT_SCOPE(INSTR_EMS_RESERVE);
+
+  if (state == NULL) {
     fprintf(stderr, "EMS state must be initialized\n");
     return 1;
   }
 
-  struct Event* event = get_event_with_delay(event_id);
+  struct Event* event = get_event_with_delay(state, event_id);
 
   if (event == NULL) {
     fprintf(stderr, "Event not found\n");
     return 1;
   }
-  size_t max_seat_length = (size_t)snprintf(NULL, 0, "%u", UINT_MAX);
-  size_t buffer_size = (event->rows * event->cols * (max_seat_length + 1)) + event->rows;
-  char *buffer = malloc(buffer_size);
 
-  if (buffer == NULL) {
-    exit(1);
+  for (size_t i = 0; i < num_seats; i++) {
+    if (xs[i] <= 0 || xs[i] > event->rows || ys[i] <= 0 || ys[i] > event->cols) {
+      fprintf(stderr, "Invalid seat\n");
+      return 1;
+    }
   }
-  size_t buffer_position = 0;
 
-  for (size_t i = 1; i <= event->rows; i++) {
-      for (size_t j = 1; j <= event->cols; j++) {
-          if (pthread_rwlock_rdlock(&event->seatlocks[seat_index(event, i, j)])) {
-            fprintf(stderr, "Lock Error\n");
-            exit(1);
-          }
-          unsigned int* seat = get_seat_with_delay(event, seat_index(event, i, j));
-          size_t len = (size_t)snprintf(buffer + buffer_position, max_seat_length + 1, "%u", *seat);
-          if (pthread_rwlock_unlock(&event->seatlocks[seat_index(event, i, j)])) {
-            fprintf(stderr, "Lock Error\n");
-            exit(1);
-          }
-          buffer_position += len;
-
-          // Add space unless it's the last column
-          if (j < event->cols) {
-              buffer[buffer_position] = ' ';
-              buffer_position++;
-          }
-      }
+  size_t* indexes = malloc(2 * num_seats * sizeof(size_t));
+  if (indexes == NULL) {
+    fprintf(stderr, "Error allocating memory for reservation\n");
+    return 1;
+  }
+  size_t* lock_ids = indexes + num_seats;
+  for (size_t i = 0; i < num_seats; i++) {
+    indexes[i] = seat_index(event, xs[i], ys[i]);
+  }
 
-      buffer[buffer_position] = '\n';
-      buffer_position++;
+  sort_seat_indexes(indexes, lock_ids, num_seats, event->rows * event->cols - 1);
+  for (size_t i = 1; i < num_seats; i++) {
+    if (indexes[i] == indexes[i - 1]) {
+      free(indexes);
+      fprintf(stderr, "Seat already reserved\n");
+      return 1;
+    }
   }
 
-  if (pthread_mutex_lock(&output_lock)) {
-    fprintf(stderr, "Lock Error\n");
-    exit(1);
+  if (event->seatlocks.mode == SEAT_LOCK_OPTIMISTIC) {
+    int result = reserve_optimistic(event, num_seats, indexes);
+    free(indexes);
+    return result;
   }
-  write(fd, buffer, buffer_position);
-  if (pthread_mutex_unlock(&output_lock)) {
-    fprintf(stderr, "Lock Error\n");
-    exit(1);
+
+  // Locks are always acquired in ascending order, so reservations can't deadlock
+  size_t num_locks = seatlock_ids(&event->seatlocks, indexes, num_seats, lock_ids);
+  for (size_t i = 0; i < num_locks; i++) {
+    seatlock_wrlock(&event->seatlocks, lock_ids[i]);
+  }
+
+  struct SeatFetch fetch;
+  begin_seat_fetch(&fetch, event, indexes, num_seats);
+  size_t first, run;
+  while ((run = next_seat_batch(&fetch, &first)) > 0) {
+    atomic_uint* seats = &event->data[indexes[first]];
+    for (size_t j = 0; j < run; j++) {
+      if (atomic_load_explicit(&seats[j], memory_order_relaxed) != 0) {
+        unlock_seats(event, lock_ids, num_locks);
+        free(indexes);
+        fprintf(stderr, "Seat already reserved\n");
+        return 1;
+      }
+    }
   }
 
-  free(buffer);
+  unsigned int reservation_id = next_reservation_id(event);
+  if (reservation_id == 0) {
+    unlock_seats(event, lock_ids, num_locks);
+    free(indexes);
+    fprintf(stderr, "Too many reservations\n");
+    return 1;
+  }
+  fetch_seats_with_delay(event, indexes, num_seats);
+  commit_seats(event, indexes, num_seats, reservation_id);
 
+  unlock_seats(event, lock_ids, num_locks);
+  free(indexes);
   return 0;
 }
 
-int ems_list_events(int fd) {
-  if (event_list == NULL) {
-    fprintf(stderr, "EMS state must be initialized\n");
-    return 1;
+/// Pays the state access delay of every seat of an event, fetching them row by row.
+static void fetch_rows_with_delay(struct Event* event) {
+  unsigned long last = 0;
+  for (size_t row = 0; row < event->rows; row++) {
+    last = state_delay_issue();
   }
+  state_delay_wait(last);
+}
 
-  if (pthread_rwlock_rdlock(&event_list->list_lock)) {
-    fprintf(stderr, "Lock Error\n");
-    exit(1);
-  }
-  if (event_list->head == NULL) {
-    if (pthread_rwlock_unlock(&event_list->list_lock)) {
-      fprintf(stderr, "Lock Error\n");
-      exit(1);
+/// Copies a consistent snapshot of the seats of an event, without taking any lock.
+/// @note The seats must have been fetched already. Retries until no reservation committed during the
+/// copy, which is short since commits only span memory stores: it yields the thread, never its fiber,
+/// so the scratch buffers of the thread stay with the SHOW that took them. Seats pending in an
+/// optimistic reservation are not committed yet, so they are copied as free.
+/// @param event Event to read the seats from.
+/// @param seats Array of size rows * cols to store the seats in.
+static void read_seats_snapshot(struct Event* event, unsigned int* seats) {
+  while (1) {
+    unsigned long version = atomic_load(&event->seat_version);
+    int consistent = atomic_load(&event->committing) == 0;
+
+    for (size_t row = 0; row < event->rows; row++) {
+      size_t first = row * event->cols;
+      atomic_uint* row_seats = &event->data[first];
+      for (size_t col = 0; col < event->cols; col++) {
+        unsigned int seat = atomic_load_explicit(&row_seats[col], memory_order_acquire);
+        seats[first + col] = seat == SEAT_PENDING ? 0 : seat;
+      }
     }
 
-    if (pthread_mutex_lock(&output_lock)) {
-      fprintf(stderr, "Lock Error\n");
-      exit(1);
+    if (consistent && atomic_load(&event->committing) == 0 && atomic_load(&event->seat_version) == version) {
+      return;
     }
-    write(fd, "No events\n", strlen("No events\n"));
-    if (pthread_mutex_unlock(&output_lock)) {
-      fprintf(stderr, "Lock Error\n");
-      exit(1);
-    }
-    return 0;
+    sched_yield();
   }
-  if (pthread_rwlock_unlock(&event_list->list_lock)) {
-    fprintf(stderr, "Lock Error\n");
-    exit(1);
+}
+
+int ems_show(struct EmsState* state, unsigned int event_id, int fd) {
+  INSTRUMENT_SCOPE(INSTR_EMS_SHOW);
+  if (state == NULL) {
+    fprintf(stderr, "EMS state must be initialized\n");
+    return 1;
   }
 
-  struct ListNode* current = event_list->head;
-  if (pthread_mutex_lock(&output_lock)) {
-    fprintf(stderr, "Lock Error\n");
-    exit(1);
+  struct Event* event = get_event_with_delay(state, event_id);
+
+  if (event == NULL) {
+    fprintf(stderr, "Event not found\n");
+    return 1;
   }
-  if (pthread_rwlock_rdlock(&event_list->list_lock)) {
-    fprintf(stderr, "Lock Error\n");
-    exit(1);
+  fetch_rows_with_delay(event);
+  struct ShowBuffers* buffers = get_show_buffers();
+  unsigned int* seats = grow_buffer(&buffers->seats, &buffers->seats_size, event->rows * event->cols * sizeof(unsigned int));
+  read_seats_snapshot(event, seats);
+
+  char* buffer = output_begin(fd, max_formatted_seats(event->rows, event->cols));
+  output_end(format_seats(buffer, seats, event->rows, event->cols));
+
+  return 0;
+}
+
+int ems_list_events(struct EmsState* state, int fd) {
+  INSTRUMENT_SCOPE(INSTR_EMS_LIST);
+  if (state == NULL) {
+    fprintf(stderr, "EMS state must be initialized\n");
+    return 1;
   }
-  while (current != NULL) {
-    write(fd, "Event: ", strlen("Event: "));
-    char event_id_str[12];
-    snprintf(event_id_str, sizeof(event_id_str), "%u", (current->event)->id);
-    write(fd, event_id_str, strlen(event_id_str));
-    write(fd, "\n", strlen("\n"));
-    current = current->next;
+
+  struct ListNode* head = list_head(state->events);
+  if (head == NULL) {
+    output_write(fd, "No events\n", strlen("No events\n"));
+    return 0;
   }
-    if (pthread_rwlock_unlock(&event_list->list_lock)) {
-      fprintf(stderr, "Lock Error\n");
-      exit(1);
-    }
-  if (pthread_mutex_unlock(&output_lock)) {
-    fprintf(stderr, "Lock Error\n");
-    exit(1);
+
+  // Events appended after the count are left out, as if they were created after the LIST
+  size_t num_events = 0;
+  for (struct ListNode* current = head; current != NULL; current = list_next(current)) {
+    num_events++;
+  }
+
+  char* buffer = output_begin(fd, num_events * LIST_LINE_SIZE);
+  size_t buffer_position = 0;
+  struct ListNode* current = head;
+  for (size_t i = 0; i < num_events; i++) {
+    buffer_position += (size_t)snprintf(buffer + buffer_position, LIST_LINE_SIZE, "Event: %u\n", current->event->id);
+    current = list_next(current);
   }
+  output_end(buffer_position);
 
   return 0;
 }
 
 void ems_wait(unsigned int delay_ms) {
-  struct timespec delay = delay_to_timespec(delay_ms);
+  INSTRUMENT_SCOPE(INSTR_EMS_WAIT);
+  struct timespec delay = {delay_ms / 1000, (delay_ms % 1000) * 1000000};
   nanosleep(&delay, NULL);
 }
@@ -3,40 +3,74 @@
 
 #include <stddef.h>
 
-/// Initializes the EMS state.
-/// @param delay_ms State access delay in milliseconds.
-/// @return 0 if the EMS state was initialized successfully, 1 otherwise.
-int ems_init(unsigned int delay_ms);
+#include "seatlock.h"
 
-/// Destroys the EMS state.
+/// Options of the EMS state.
+struct EmsOptions {
+  unsigned int delay_us;             /// State access delay in microseconds, 0 for none.
+  unsigned int access_depth;         /// State accesses a thread keeps in flight at once, see statedelay.h.
+  enum SeatLockMode seat_lock_mode;  /// Granularity of the locks protecting the seats of each event.
+  size_t shared_size;                /// Size of the shared memory region in bytes, 0 for one state per jobs file.
+  const char* store_path;            /// Path of the persistent store (see store.h), NULL for none.
+  const char* log_path;              /// Path of the reservation log (see wal.h), NULL for none.
+};
+
+/// Events of a venue database, opaque outside of operations.c.
+struct EmsState;
+
+/// Initializes the EMS with the options shared by every state.
+/// @note With a shared memory region, the EMS has a single state that every jobs file works on, also
+/// after forking. It must then be initialized before the processes are forked. With a persistent
+/// store or a log, the single state starts with the events of the store and the log replayed on top,
+/// and must not be used after forking.
+/// @param options Options of the EMS state.
+/// @return 0 if the EMS was initialized successfully, 1 otherwise.
+int ems_init(struct EmsOptions const *options);
+
+/// Terminates the EMS, after every state has been destroyed.
 int ems_terminate();
 
+/// Creates an empty EMS state, or gets the single one of shared, store and log modes.
+/// @return The state, NULL if it could not be created.
+struct EmsState* ems_state_create();
+
+/// Destroys an EMS state and all of its events.
+/// @note Does nothing to the single state of shared, store and log modes, which is destroyed by ems_terminate.
+/// @param state State to be destroyed, no longer in use by any thread.
+void ems_state_destroy(struct EmsState* state);
+
 /// Creates a new event with the given id and dimensions.
+/// @param state State to create the event in.
 /// @param event_id Id of the event to be created.
 /// @param num_rows Number of rows of the event to be created.
 /// @param num_cols Number of columns of the event to be created.
 /// @return 0 if the event was created successfully, 1 otherwise.
-int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols);
+int ems_create(struct EmsState* state, unsigned int event_id, size_t num_rows, size_t num_cols);
 
 /// Creates a new reservation for the given event.
+/// @param state State the event belongs to.
 /// @param event_id Id of the event to create a reservation for.
 /// @param num_seats Number of seats to reserve.
 /// @param xs Array of rows of the seats to reserve.
 /// @param ys Array of columns of the seats to reserve.
 /// @return 0 if the reservation was created successfully, 1 otherwise.
-int ems_reserve(unsigned int event_id, size_t num_seats, size_t *xs, size_t *ys);
+int ems_reserve(struct EmsState* state, unsigned int event_id, size_t num_seats, size_t *xs, size_t *ys);
 
 /// Prints the given event.
+/// @note Output is buffered by the calling thread until output_flush (see output.h).
+/// @param state State the event belongs to.
 /// @param event_id Id of the event to print.
 /// @return 0 if the event was printed successfully, 1 otherwise.
-int ems_show(unsigned int event_id, int fd);
+int ems_show(struct EmsState* state, unsigned int event_id, int fd);
 
 /// Prints all the events.
+/// @note Output is buffered by the calling thread until output_flush (see output.h).
+/// @param state State to list the events of.
 /// @return 0 if the events were printed successfully, 1 otherwise.
-int ems_list_events(int fd);
+int ems_list_events(struct EmsState* state, int fd);
 
 /// Waits for a given amount of time.
-/// @param delay_us Delay in milliseconds.
+/// @param delay_ms Delay in milliseconds.
 void ems_wait(unsigned int delay_ms);
 
 #endif  // EMS_OPERATIONS_H
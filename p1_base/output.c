@@ -0,0 +1,213 @@
+#include "output.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "instrument.h"
+
+// Output is coalesced in per-thread chunks and written with a single writev per flush. Writes to a
+// regular file update the file offset atomically, so the output of different threads never interleaves
+// within a flush and no lock is shared between threads.
+
+struct OutputChunk {
+  char* data;
+  size_t len;
+  size_t size;
+};
+
+struct OutputBuffer {
+  int fd;                                         /// File descriptor the buffered output is for.
+  struct OutputChunk chunks[OUTPUT_MAX_CHUNKS];   /// Chunks in use are kept allocated after a flush.
+  size_t num_chunks;                              /// Number of chunks holding output.
+  size_t buffered;                                /// Number of bytes waiting to be written.
+  int held;                                       /// Whether automatic flushes are disabled.
+};
+
+static pthread_key_t output_key;
+static pthread_once_t output_key_once = PTHREAD_ONCE_INIT;
+
+void output_writev(int fd, struct iovec* iov, int iovcnt) {
+  INSTRUMENT_SCOPE(INSTR_OUTPUT_WRITE);
+  int first = 0;
+  while (first < iovcnt) {
+    ssize_t written = writev(fd, iov + first, iovcnt - first);
+    if (written == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "Failed to write output\n");
+      return;
+    }
+    size_t remaining = (size_t)written;
+    while (first < iovcnt && remaining >= iov[first].iov_len) {
+      remaining -= iov[first].iov_len;
+      first++;
+    }
+    if (first < iovcnt) {
+      iov[first].iov_base = (char*)iov[first].iov_base + remaining;
+      iov[first].iov_len -= remaining;
+    }
+  }
+}
+
+/// Empties the buffer without writing it.
+static void clear_buffer(struct OutputBuffer* output) {
+  for (size_t i = 0; i < output->num_chunks; i++) {
+    output->chunks[i].len = 0;
+  }
+  output->num_chunks = 0;
+  output->buffered = 0;
+}
+
+static void flush_buffer(struct OutputBuffer* output) {
+  struct iovec iov[OUTPUT_MAX_CHUNKS];
+  int iovcnt = 0;
+  for (size_t i = 0; i < output->num_chunks; i++) {
+    if (output->chunks[i].len > 0) {
+      iov[iovcnt].iov_base = output->chunks[i].data;
+      iov[iovcnt].iov_len = output->chunks[i].len;
+      iovcnt++;
+    }
+  }
+
+  output_writev(output->fd, iov, iovcnt);
+
+  clear_buffer(output);
+}
+
+/// Copies the buffered output to a single allocation.
+/// @return Newly allocated copy of the output.
+static char* copy_buffer(struct OutputBuffer* output) {
+  char* data = malloc(output->buffered > 0 ? output->buffered : 1);
+  if (data == NULL) {
+    fprintf(stderr, "Error allocating memory for output buffers\n");
+    exit(1);
+  }
+  size_t pos = 0;
+  for (size_t i = 0; i < output->num_chunks; i++) {
+    memcpy(data + pos, output->chunks[i].data, output->chunks[i].len);
+    pos += output->chunks[i].len;
+  }
+  return data;
+}
+
+/// Makes room for another chunk: flushes the buffer, or when flushes are held merges it into its
+/// first chunk so that it stays buffered.
+static void merge_chunks(struct OutputBuffer* output) {
+  if (!output->held) {
+    flush_buffer(output);
+    return;
+  }
+
+  char* data = copy_buffer(output);
+  size_t len = output->buffered;
+  clear_buffer(output);
+  free(output->chunks[0].data);
+  output->chunks[0].data = data;
+  output->chunks[0].len = len;
+  output->chunks[0].size = len > 0 ? len : 1;
+  output->num_chunks = 1;
+  output->buffered = len;
+}
+
+static void free_output_buffer(void* arg) {
+  struct OutputBuffer* output = arg;
+  flush_buffer(output);
+  for (size_t i = 0; i < OUTPUT_MAX_CHUNKS; i++) {
+    free(output->chunks[i].data);
+  }
+  free(output);
+}
+
+static void create_output_key() {
+  if (pthread_key_create(&output_key, free_output_buffer)) {
+    fprintf(stderr, "Error creating output buffers\n");
+    exit(1);
+  }
+}
+
+/// Gets the output buffer of the calling thread.
+static struct OutputBuffer* get_output_buffer() {
+  if (pthread_once(&output_key_once, create_output_key)) {
+    fprintf(stderr, "Error creating output buffers\n");
+    exit(1);
+  }
+
+  struct OutputBuffer* output = pthread_getspecific(output_key);
+  if (output == NULL) {
+    output = calloc(1, sizeof(struct OutputBuffer));
+    if (output == NULL || pthread_setspecific(output_key, output)) {
+      fprintf(stderr, "Error allocating memory for output buffers\n");
+      exit(1);
+    }
+    output->fd = -1;
+  }
+  return output;
+}
+
+char* output_begin(int fd, size_t max_len) {
+  struct OutputBuffer* output = get_output_buffer();
+  if (output->fd != fd) {
+    flush_buffer(output);
+    output->fd = fd;
+  }
+
+  if (output->num_chunks > 0) {
+    struct OutputChunk* last = &output->chunks[output->num_chunks - 1];
+    if (last->size - last->len >= max_len) {
+      return last->data + last->len;
+    }
+  }
+
+  if (output->num_chunks == OUTPUT_MAX_CHUNKS) {
+    merge_chunks(output);
+  }
+  struct OutputChunk* chunk = &output->chunks[output->num_chunks++];
+  if (chunk->size < max_len) {
+    size_t size = max_len > OUTPUT_CHUNK_SIZE ? max_len : OUTPUT_CHUNK_SIZE;
+    free(chunk->data);
+    chunk->data = malloc(size);
+    if (chunk->data == NULL) {
+      fprintf(stderr, "Error allocating memory for output buffers\n");
+      exit(1);
+    }
+    chunk->size = size;
+  }
+  return chunk->data;
+}
+
+void output_end(size_t len) {
+  struct OutputBuffer* output = get_output_buffer();
+  output->chunks[output->num_chunks - 1].len += len;
+  output->buffered += len;
+  if (!output->held && output->buffered >= OUTPUT_FLUSH_SIZE) {
+    flush_buffer(output);
+  }
+}
+
+void output_write(int fd, const char* data, size_t len) {
+  memcpy(output_begin(fd, len), data, len);
+  output_end(len);
+}
+
+void output_flush() { flush_buffer(get_output_buffer()); }
+
+void output_hold(int hold) { get_output_buffer()->held = hold; }
+
+char* output_take(size_t* len) {
+  struct OutputBuffer* output = get_output_buffer();
+  *len = output->buffered;
+  if (output->buffered == 0) {
+    clear_buffer(output);
+    return NULL;
+  }
+
+  char* data = copy_buffer(output);
+  clear_buffer(output);
+  return data;
+}
@@ -0,0 +1,44 @@
+#ifndef EMS_OUTPUT_H
+#define EMS_OUTPUT_H
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+/// Writes a vector of buffers entirely, resuming after partial writes.
+/// @param fd File descriptor to write to.
+/// @param iov Buffers to be written, modified to track progress.
+/// @param iovcnt Number of buffers.
+void output_writev(int fd, struct iovec* iov, int iovcnt);
+
+/// Gets space for the output of a command in the calling thread's output buffer.
+/// @note The output of each command is kept contiguous: it is only flushed as a whole, together with
+/// the output of the other commands the thread buffered before it.
+/// @param fd File descriptor the output is for. Output buffered for another one is flushed first.
+/// @param max_len Largest number of bytes the command will write.
+/// @return Pointer to at least max_len bytes, valid until output_end.
+char* output_begin(int fd, size_t max_len);
+
+/// Ends the output of a command started with output_begin.
+/// @note Flushes the buffer once it holds OUTPUT_FLUSH_SIZE bytes.
+/// @param len Number of bytes written by the command.
+void output_end(size_t len);
+
+/// Buffers the whole output of a command.
+/// @param fd File descriptor the output is for.
+/// @param data Output of the command.
+/// @param len Number of bytes of output.
+void output_write(int fd, const char* data, size_t len);
+
+/// Writes everything buffered by the calling thread.
+void output_flush();
+
+/// Stops or resumes the automatic flushes of the calling thread's buffer.
+/// @param hold 1 to keep all output buffered until output_take or output_flush, 0 to resume flushing.
+void output_hold(int hold);
+
+/// Takes the output buffered by the calling thread instead of writing it.
+/// @param len Pointer to the variable to store the number of bytes in.
+/// @return Newly allocated copy of the output, NULL if there is none.
+char* output_take(size_t* len);
+
+#endif  // EMS_OUTPUT_H
@@ -0,0 +1,96 @@
+#include "parking.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fiber.h"
+#include "statemem.h"
+
+#define PARKING_BUCKETS 64
+
+/// Threads parked on the words hashed to it.
+struct ParkingBucket {
+  pthread_mutex_t lock;
+  pthread_cond_t woken;
+  atomic_uint waiters;  /// Number of threads parked, so unpark can skip the lock when there are none.
+};
+
+static struct ParkingBucket* buckets = NULL;
+
+/// Gets the bucket of a word.
+static struct ParkingBucket* bucket_of(void const* addr) {
+  return &buckets[((uintptr_t)addr / sizeof(unsigned int)) % PARKING_BUCKETS];
+}
+
+int parking_init() {
+  buckets = state_alloc(PARKING_BUCKETS * sizeof(struct ParkingBucket));
+  if (buckets == NULL) {
+    return 1;
+  }
+  for (size_t i = 0; i < PARKING_BUCKETS; i++) {
+    if (state_mutex_init(&buckets[i].lock) || state_cond_init(&buckets[i].woken)) {
+      fprintf(stderr, "Lock Error\n");
+      exit(1);
+    }
+    atomic_init(&buckets[i].waiters, 0);
+  }
+  return 0;
+}
+
+void parking_destroy() {
+  if (buckets == NULL) {
+    return;
+  }
+  for (size_t i = 0; i < PARKING_BUCKETS; i++) {
+    if (pthread_mutex_destroy(&buckets[i].lock) || pthread_cond_destroy(&buckets[i].woken)) {
+      fprintf(stderr, "Lock Error\n");
+      exit(1);
+    }
+  }
+  state_free(buckets);
+  buckets = NULL;
+}
+
+void park(void const* addr, int (*blocked)(void const* arg), void const* arg) {
+  if (fiber_running()) {
+    fiber_yield();
+    return;
+  }
+
+  struct ParkingBucket* bucket = bucket_of(addr);
+  if (pthread_mutex_lock(&bucket->lock)) {
+    fprintf(stderr, "Lock Error\n");
+    exit(1);
+  }
+  // Either the waker sees the waiter counted, or the waiter sees the change (see unpark)
+  atomic_fetch_add(&bucket->waiters, 1);
+  atomic_thread_fence(memory_order_seq_cst);
+  while (blocked(arg)) {
+    if (pthread_cond_wait(&bucket->woken, &bucket->lock)) {
+      fprintf(stderr, "Lock Error\n");
+      exit(1);
+    }
+  }
+  atomic_fetch_sub(&bucket->waiters, 1);
+  if (pthread_mutex_unlock(&bucket->lock)) {
+    fprintf(stderr, "Lock Error\n");
+    exit(1);
+  }
+}
+
+void unpark(void const* addr) {
+  struct ParkingBucket* bucket = bucket_of(addr);
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&bucket->waiters, memory_order_relaxed) == 0) {
+    return;
+  }
+  // Waiters only count themselves with the lock held, and keep it until they sleep on the condition
+  if (pthread_mutex_lock(&bucket->lock) || pthread_cond_broadcast(&bucket->woken) ||
+      pthread_mutex_unlock(&bucket->lock)) {
+    fprintf(stderr, "Lock Error\n");
+    exit(1);
+  }
+}
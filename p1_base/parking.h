@@ -0,0 +1,32 @@
+#ifndef EMS_PARKING_H
+#define EMS_PARKING_H
+
+/// Blocking waits on words of the EMS state, for the lock-free paths that would otherwise spin.
+/// @note Waiters park in a bucket picked by hashing the address of the word, so unrelated words may
+/// share one: parked threads recheck their own condition whenever the bucket is woken.
+
+/// Creates the buckets waiters park in.
+/// @note Must be called after the shared memory region is mapped, if there is one, so processes
+/// sharing the EMS state also share the buckets.
+/// @return 0 if the buckets were created successfully, 1 otherwise.
+int parking_init();
+
+/// Destroys the buckets.
+void parking_destroy();
+
+/// Waits while a word of the EMS state keeps a condition.
+/// @note On a fiber, it yields once instead of blocking, since the thread may be the one that has to
+/// change the word, so callers must recheck the condition when it returns. Otherwise, the condition is
+/// checked with the bucket locked, so a change followed by unpark can't be missed.
+/// @param addr Address of the word.
+/// @param blocked Function checking whether the condition still holds.
+/// @param arg Argument passed to blocked.
+void park(void const* addr, int (*blocked)(void const* arg), void const* arg);
+
+/// Wakes the threads parked on a word of the EMS state.
+/// @note Must be called after every change of the word that waiters may be parked for. It only locks
+/// the bucket when there are threads parked in it.
+/// @param addr Address of the word.
+void unpark(void const* addr);
+
+#endif  // EMS_PARKING_H
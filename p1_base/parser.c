@@ -1,5 +1,6 @@
 #include "parser.h"
 
+#include <errno.h>
 #include <limits.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,29 +8,132 @@
 
 #include "constants.h"
 
+struct InputBuffer {
+  char data[PARSER_BUFFER_SIZE];  /// Bytes read from the file but not yet consumed.
+  size_t pos;                     /// Position of the next byte to be consumed.
+  size_t len;                     /// Number of valid bytes in data.
+};
+
+/// Input buffers indexed by file descriptor, allocated on first use.
+static struct InputBuffer *input_buffers[PARSER_MAX_FDS];
+
+/// Gets the input buffer of a file descriptor.
+/// @param fd File descriptor to get the buffer for.
+/// @return Pointer to the buffer, NULL if the file descriptor can't be buffered.
+static struct InputBuffer *get_input_buffer(int fd) {
+  if (fd < 0 || fd >= PARSER_MAX_FDS) {
+    return NULL;
+  }
+
+  struct InputBuffer *input = input_buffers[fd];
+  if (input == NULL) {
+    input = malloc(sizeof(struct InputBuffer));
+    if (input == NULL) {
+      return NULL;
+    }
+    input->pos = 0;
+    input->len = 0;
+    input_buffers[fd] = input;
+  }
+
+  return input;
+}
+
+/// Refills an empty input buffer with the next block of the file.
+/// @param fd File descriptor to read from.
+/// @param input Buffer of the file descriptor.
+/// @return Number of bytes available in the buffer, 0 on end of file or error.
+static size_t refill(int fd, struct InputBuffer *input) {
+  ssize_t bytes_read;
+  do {
+    bytes_read = read(fd, input->data, PARSER_BUFFER_SIZE);
+  } while (bytes_read == -1 && errno == EINTR);
+
+  input->pos = 0;
+  input->len = bytes_read > 0 ? (size_t)bytes_read : 0;
+  return input->len;
+}
+
+/// Reads up to n bytes, serving them from the buffer of the file descriptor.
+/// @param fd File descriptor to read from.
+/// @param dest Array to store the bytes in.
+/// @param n Number of bytes to read.
+/// @return Number of bytes read, less than n only at the end of the file.
+static size_t read_bytes(int fd, char *dest, size_t n) {
+  struct InputBuffer *input = get_input_buffer(fd);
+  if (input == NULL) {
+    ssize_t bytes_read = read(fd, dest, n);
+    return bytes_read > 0 ? (size_t)bytes_read : 0;
+  }
+
+  size_t done = 0;
+  while (done < n) {
+    if (input->pos == input->len && refill(fd, input) == 0) {
+      break;
+    }
+
+    size_t chunk = input->len - input->pos;
+    if (chunk > n - done) {
+      chunk = n - done;
+    }
+    memcpy(dest + done, input->data + input->pos, chunk);
+    input->pos += chunk;
+    done += chunk;
+  }
+
+  return done;
+}
+
+/// Reads a single byte from the file descriptor.
+/// @param fd File descriptor to read from.
+/// @param ch Pointer to the variable to store the byte in.
+/// @return 1 if a byte was read, 0 at the end of the file.
+static int read_char(int fd, char *ch) {
+  if (fd >= 0 && fd < PARSER_MAX_FDS) {
+    struct InputBuffer *input = input_buffers[fd];
+    if (input != NULL && input->pos < input->len) {
+      *ch = input->data[input->pos++];
+      return 1;
+    }
+  }
+
+  return read_bytes(fd, ch, 1) == 1;
+}
+
+void release_input(int fd) {
+  if (fd < 0 || fd >= PARSER_MAX_FDS) {
+    return;
+  }
+
+  free(input_buffers[fd]);
+  input_buffers[fd] = NULL;
+}
+
 static int read_uint(int fd, unsigned int *value, char *next) {
-  char buf[16];
+  unsigned long ul = 0;
+  int overflow = 0;
 
-  int i = 0;
   while (1) {
-    if (read(fd, buf + i, 1) == 0) {
+    char ch;
+    if (!read_char(fd, &ch)) {
       *next = '\0';
       break;
     }
 
-    *next = buf[i];
+    *next = ch;
 
-    if (buf[i] > '9' || buf[i] < '0') {
-      buf[i] = '\0';
+    if (ch > '9' || ch < '0') {
       break;
     }
 
-    i++;
+    ul = ul * 10 + (unsigned long)(ch - '0');
+    if (ul > UINT_MAX) {
+      overflow = 1;
+      ul = 0;
+    }
   }
 
-  unsigned long ul = strtoul(buf, NULL, 10);
-
-  if (ul > UINT_MAX) {
+  if (overflow) {
     return 1;
   }
 
@@ -40,19 +144,19 @@ static int read_uint(int fd, unsigned int *value, char *next) {
 
 static void cleanup(int fd) {
   char ch;
-  while (read(fd, &ch, 1) == 1 && ch != '\n')
+  while (read_char(fd, &ch) == 1 && ch != '\n')
     ;
 }
 
 enum Command get_next(int fd) {
   char buf[16];
-  if (read(fd, buf, 1) != 1) {
+  if (read_bytes(fd, buf, 1) != 1) {
     return EOC;
   }
 
   switch (buf[0]) {
     case 'C':
-      if (read(fd, buf + 1, 6) != 6 || strncmp(buf, "CREATE ", 7) != 0) {
+      if (read_bytes(fd, buf + 1, 6) != 6 || strncmp(buf, "CREATE ", 7) != 0) {
         cleanup(fd);
         return CMD_INVALID;
       }
@@ -60,7 +164,7 @@ enum Command get_next(int fd) {
       return CMD_CREATE;
 
     case 'R':
-      if (read(fd, buf + 1, 7) != 7 || strncmp(buf, "RESERVE ", 8) != 0) {
+      if (read_bytes(fd, buf + 1, 7) != 7 || strncmp(buf, "RESERVE ", 8) != 0) {
         cleanup(fd);
         return CMD_INVALID;
       }
@@ -68,7 +172,7 @@ enum Command get_next(int fd) {
       return CMD_RESERVE;
 
     case 'S':
-      if (read(fd, buf + 1, 4) != 4 || strncmp(buf, "SHOW ", 5) != 0) {
+      if (read_bytes(fd, buf + 1, 4) != 4 || strncmp(buf, "SHOW ", 5) != 0) {
         cleanup(fd);
         return CMD_INVALID;
       }
@@ -76,12 +180,12 @@ enum Command get_next(int fd) {
       return CMD_SHOW;
 
     case 'L':
-      if (read(fd, buf + 1, 3) != 3 || strncmp(buf, "LIST", 4) != 0) {
+      if (read_bytes(fd, buf + 1, 3) != 3 || strncmp(buf, "LIST", 4) != 0) {
         cleanup(fd);
         return CMD_INVALID;
       }
 
-      if (read(fd, buf + 4, 1) != 0 && buf[4] != '\n') {
+      if (read_bytes(fd, buf + 4, 1) != 0 && buf[4] != '\n') {
         cleanup(fd);
         return CMD_INVALID;
       }
@@ -89,12 +193,12 @@ enum Command get_next(int fd) {
       return CMD_LIST_EVENTS;
 
     case 'B':
-      if (read(fd, buf + 1, 6) != 6 || strncmp(buf, "BARRIER", 7) != 0) {
+      if (read_bytes(fd, buf + 1, 6) != 6 || strncmp(buf, "BARRIER", 7) != 0) {
         cleanup(fd);
         return CMD_INVALID;
       }
 
-      if (read(fd, buf + 7, 1) != 0 && buf[7] != '\n') {
+      if (read_bytes(fd, buf + 7, 1) != 0 && buf[7] != '\n') {
         cleanup(fd);
         return CMD_INVALID;
       }
@@ -102,7 +206,7 @@ enum Command get_next(int fd) {
       return CMD_BARRIER;
 
     case 'W':
-      if (read(fd, buf + 1, 4) != 4 || strncmp(buf, "WAIT ", 5) != 0) {
+      if (read_bytes(fd, buf + 1, 4) != 4 || strncmp(buf, "WAIT ", 5) != 0) {
         cleanup(fd);
         return CMD_INVALID;
       }
@@ -110,12 +214,12 @@ enum Command get_next(int fd) {
       return CMD_WAIT;
 
     case 'H':
-      if (read(fd, buf + 1, 3) != 3 || strncmp(buf, "HELP", 4) != 0) {
+      if (read_bytes(fd, buf + 1, 3) != 3 || strncmp(buf, "HELP", 4) != 0) {
         cleanup(fd);
         return CMD_INVALID;
       }
 
-      if (read(fd, buf + 4, 1) != 0 && buf[4] != '\n') {
+      if (read_bytes(fd, buf + 4, 1) != 0 && buf[4] != '\n') {
         cleanup(fd);
         return CMD_INVALID;
       }
@@ -168,14 +272,14 @@ size_t parse_reserve(int fd, size_t max, unsigned int *event_id, size_t *xs, siz
     return 0;
   }
 
-  if (read(fd, &ch, 1) != 1 || ch != '[') {
+  if (read_char(fd, &ch) != 1 || ch != '[') {
     cleanup(fd);
     return 0;
   }
 
   size_t num_coords = 0;
   while (num_coords < max) {
-    if (read(fd, &ch, 1) != 1 || ch != '(') {
+    if (read_char(fd, &ch) != 1 || ch != '(') {
       cleanup(fd);
       return 0;
     }
@@ -196,7 +300,7 @@ size_t parse_reserve(int fd, size_t max, unsigned int *event_id, size_t *xs, siz
 
     num_coords++;
 
-    if (read(fd, &ch, 1) != 1 || (ch != ' ' && ch != ']')) {
+    if (read_char(fd, &ch) != 1 || (ch != ' ' && ch != ']')) {
       cleanup(fd);
       return 0;
     }
@@ -211,7 +315,7 @@ size_t parse_reserve(int fd, size_t max, unsigned int *event_id, size_t *xs, siz
     return 0;
   }
 
-  if (read(fd, &ch, 1) != 1 || (ch != '\n' && ch != '\0')) {
+  if (read_char(fd, &ch) != 1 || (ch != '\n' && ch != '\0')) {
     cleanup(fd);
     return 0;
   }
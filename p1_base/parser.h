@@ -16,6 +16,11 @@ enum Command {
   EOC  // End of commands
 };
 
+/// Releases the input buffer of a file descriptor.
+/// @note Input is read in blocks, so this must be called before the file descriptor is closed or reused.
+/// @param fd File descriptor whose buffer should be released.
+void release_input(int fd);
+
 /// Reads a line and returns the corresponding command.
 /// @param fd File descriptor to read from.
 /// @return The command read.
@@ -0,0 +1,124 @@
+#include "reorder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fiber.h"
+#include "instrument.h"
+#include "output.h"
+
+#define REORDER_MAX_IOV 64
+
+static void lock_reorder(struct ReorderBuffer* reorder) {
+  INSTRUMENT_START(start);
+  if (pthread_mutex_lock(&reorder->lock)) {
+    fprintf(stderr, "Lock Error\n");
+    exit(1);
+  }
+  INSTRUMENT_END(INSTR_REORDER_LOCK, start);
+}
+
+static void unlock_reorder(struct ReorderBuffer* reorder) {
+  if (pthread_mutex_unlock(&reorder->lock)) {
+    fprintf(stderr, "Lock Error\n");
+    exit(1);
+  }
+}
+
+/// Waits for next_seq to advance, with the reorder lock held.
+/// @note On a fiber, the commands waited for may run on other fibers of the thread, so it lets them run
+/// without the lock rather than block the thread on the condition. Callers check again either way.
+static void wait_advanced(struct ReorderBuffer* reorder) {
+  if (fiber_running()) {
+    unlock_reorder(reorder);
+    fiber_yield();
+    lock_reorder(reorder);
+    return;
+  }
+  if (pthread_cond_wait(&reorder->advanced, &reorder->lock)) {
+    fprintf(stderr, "Lock Error\n");
+    exit(1);
+  }
+}
+
+/// Writes the completed commands that follow the last written one.
+/// @note Must be called with the reorder lock held.
+static void drain(struct ReorderBuffer* reorder) {
+  unsigned long start = reorder->next_seq;
+
+  while (reorder->slots[reorder->next_seq % reorder->capacity].done) {
+    struct iovec iov[REORDER_MAX_IOV];
+    int iovcnt = 0;
+    unsigned long first = reorder->next_seq;
+    unsigned long seq = first;
+    for (; iovcnt < REORDER_MAX_IOV && reorder->slots[seq % reorder->capacity].done; seq++) {
+      struct ReorderSlot* slot = &reorder->slots[seq % reorder->capacity];
+      if (slot->len > 0) {
+        iov[iovcnt].iov_base = slot->data;
+        iov[iovcnt].iov_len = slot->len;
+        iovcnt++;
+      }
+    }
+    output_writev(reorder->fd, iov, iovcnt);
+
+    for (; first < seq; first++) {
+      struct ReorderSlot* slot = &reorder->slots[first % reorder->capacity];
+      free(slot->data);
+      slot->data = NULL;
+      slot->len = 0;
+      slot->done = 0;
+    }
+    reorder->next_seq = seq;
+  }
+
+  if (reorder->next_seq != start && pthread_cond_broadcast(&reorder->advanced)) {
+    fprintf(stderr, "Lock Error\n");
+    exit(1);
+  }
+}
+
+int reorder_init(struct ReorderBuffer* reorder, int fd, size_t capacity) {
+  reorder->slots = calloc(capacity, sizeof(struct ReorderSlot));
+  if (reorder->slots == NULL) {
+    return 1;
+  }
+  reorder->fd = fd;
+  reorder->next_seq = 0;
+  reorder->capacity = capacity;
+  if (pthread_mutex_init(&reorder->lock, NULL) || pthread_cond_init(&reorder->advanced, NULL)) {
+    free(reorder->slots);
+    return 1;
+  }
+  return 0;
+}
+
+void reorder_destroy(struct ReorderBuffer* reorder) {
+  if (pthread_mutex_destroy(&reorder->lock) || pthread_cond_destroy(&reorder->advanced)) {
+    fprintf(stderr, "Lock Error\n");
+    exit(1);
+  }
+  free(reorder->slots);
+}
+
+void reorder_wait(struct ReorderBuffer* reorder, unsigned long count) {
+  lock_reorder(reorder);
+  while (reorder->next_seq < count) {
+    wait_advanced(reorder);
+  }
+  unlock_reorder(reorder);
+}
+
+void reorder_complete(struct ReorderBuffer* reorder, unsigned long seq, char* data, size_t len) {
+  lock_reorder(reorder);
+  // The oldest unwritten command was popped before this one, so it completes without waiting on it
+  while (seq >= reorder->next_seq + reorder->capacity) {
+    wait_advanced(reorder);
+  }
+
+  struct ReorderSlot* slot = &reorder->slots[seq % reorder->capacity];
+  slot->data = data;
+  slot->len = len;
+  slot->done = 1;
+  drain(reorder);
+  unlock_reorder(reorder);
+}
@@ -0,0 +1,48 @@
+#ifndef EMS_REORDER_H
+#define EMS_REORDER_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+struct ReorderSlot {
+  int done;    /// Whether the command has completed.
+  char* data;  /// Output of the command, owned by the slot.
+  size_t len;
+};
+
+/// Reorder buffer that writes the output of commands in the order of their sequence numbers.
+/// Commands are numbered from 0 in the order they appear in the jobs file.
+struct ReorderBuffer {
+  int fd;                     /// File descriptor the output is written to.
+  unsigned long next_seq;     /// Every command before this one has been written.
+  struct ReorderSlot* slots;  /// Slot of command seq is slots[seq % capacity].
+  size_t capacity;
+  pthread_mutex_t lock;
+  pthread_cond_t advanced;    /// Signaled when next_seq advances.
+};
+
+/// Initializes a reorder buffer.
+/// @param reorder Reorder buffer to be initialized.
+/// @param fd File descriptor the output is written to.
+/// @param capacity Largest number of completed commands waiting for an earlier one.
+/// @return 0 if the reorder buffer was initialized successfully, 1 otherwise.
+int reorder_init(struct ReorderBuffer* reorder, int fd, size_t capacity);
+
+/// Destroys a reorder buffer.
+/// @param reorder Reorder buffer to be destroyed, with every command written.
+void reorder_destroy(struct ReorderBuffer* reorder);
+
+/// Waits until the given number of commands have completed and been written.
+/// @param reorder Reorder buffer to wait on.
+/// @param count Number of commands, counted from the start of the file.
+void reorder_wait(struct ReorderBuffer* reorder, unsigned long count);
+
+/// Completes a command, writing its output once every command before it has been written.
+/// @note Waits while the command is too far ahead of the oldest unwritten one.
+/// @param reorder Reorder buffer to be modified.
+/// @param seq Sequence number of the command.
+/// @param data Output of the command, freed by the reorder buffer. May be NULL if len is 0.
+/// @param len Number of bytes of output.
+void reorder_complete(struct ReorderBuffer* reorder, unsigned long seq, char* data, size_t len);
+
+#endif  // EMS_REORDER_H
@@ -0,0 +1,93 @@
+#include "seatformat.h"
+
+#include <string.h>
+
+#define MAX_UINT_DIGITS 10
+
+static const char digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+/// Writes the decimal representation of a number, two digits at a time.
+/// @return Number of bytes written.
+static size_t format_uint(char* out, unsigned int value) {
+  if (value < 10) {
+    *out = (char)('0' + value);
+    return 1;
+  }
+
+  char digits[MAX_UINT_DIGITS];
+  size_t pos = MAX_UINT_DIGITS;
+  while (value >= 100) {
+    unsigned int pair = value % 100;
+    value /= 100;
+    pos -= 2;
+    memcpy(digits + pos, digit_pairs + 2 * pair, 2);
+  }
+  if (value >= 10) {
+    pos -= 2;
+    memcpy(digits + pos, digit_pairs + 2 * value, 2);
+  } else {
+    digits[--pos] = (char)('0' + value);
+  }
+
+  memcpy(out, digits + pos, MAX_UINT_DIGITS - pos);
+  return MAX_UINT_DIGITS - pos;
+}
+
+/// Writes a row of free seats, "0 0 ... 0\n", eight bytes at a time.
+/// @return Number of bytes written.
+static size_t format_free_row(char* out, size_t cols) {
+  static const char zeros[8] = {'0', ' ', '0', ' ', '0', ' ', '0', ' '};
+  size_t len = 2 * cols;
+  size_t pos = 0;
+  for (; pos + sizeof(zeros) <= len; pos += sizeof(zeros)) {
+    memcpy(out + pos, zeros, sizeof(zeros));
+  }
+  memcpy(out + pos, zeros, len - pos);
+  out[len - 1] = '\n';
+  return len;
+}
+
+static int is_free_row(unsigned int const* seats, size_t cols) {
+  unsigned int reserved = 0;
+  for (size_t col = 0; col < cols; col++) {
+    reserved |= seats[col];
+  }
+  return reserved == 0;
+}
+
+size_t max_formatted_seats(size_t rows, size_t cols) { return rows * cols * (MAX_UINT_DIGITS + 1) + rows; }
+
+size_t format_seats(char* buffer, unsigned int const* seats, size_t rows, size_t cols) {
+  size_t pos = 0;
+
+  for (size_t row = 0; row < rows; row++) {
+    unsigned int const* row_seats = seats + row * cols;
+    if (cols == 0) {
+      buffer[pos++] = '\n';
+      continue;
+    }
+    if (is_free_row(row_seats, cols)) {
+      pos += format_free_row(buffer + pos, cols);
+      continue;
+    }
+
+    for (size_t col = 0; col < cols; col++) {
+      pos += format_uint(buffer + pos, row_seats[col]);
+      buffer[pos++] = ' ';
+    }
+    // The last column is followed by the end of the line instead of a space
+    buffer[pos - 1] = '\n';
+  }
+
+  return pos;
+}
@@ -0,0 +1,20 @@
+#ifndef EMS_SEAT_FORMAT_H
+#define EMS_SEAT_FORMAT_H
+
+#include <stddef.h>
+
+/// Gets the largest number of bytes format_seats can write for an event.
+/// @param rows Number of rows of the event.
+/// @param cols Number of columns of the event.
+/// @return Size of a buffer large enough for any grid of that size.
+size_t max_formatted_seats(size_t rows, size_t cols);
+
+/// Formats a grid of seats as rows of space separated reservation ids.
+/// @param buffer Buffer to write the text to, of at least max_formatted_seats(rows, cols) bytes.
+/// @param seats Array of size rows * cols with the reservation of each seat.
+/// @param rows Number of rows.
+/// @param cols Number of columns.
+/// @return Number of bytes written.
+size_t format_seats(char* buffer, unsigned int const* seats, size_t rows, size_t cols);
+
+#endif  // EMS_SEAT_FORMAT_H
@@ -0,0 +1,182 @@
+#include "seatlock.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fiber.h"
+#include "instrument.h"
+#include "parking.h"
+#include "statemem.h"
+
+#define SEAT_LOCK_STRIPES 64
+#define SEAT_LOCK_BITS (8 * sizeof(unsigned long))
+
+int parse_seat_lock_mode(const char* name, enum SeatLockMode* mode) {
+  if (strcmp(name, "seat") == 0) {
+    *mode = SEAT_LOCK_SEAT;
+  } else if (strcmp(name, "row") == 0) {
+    *mode = SEAT_LOCK_ROW;
+  } else if (strcmp(name, "striped") == 0) {
+    *mode = SEAT_LOCK_STRIPED;
+  } else if (strcmp(name, "bit") == 0) {
+    *mode = SEAT_LOCK_BIT;
+  } else if (strcmp(name, "optimistic") == 0) {
+    *mode = SEAT_LOCK_OPTIMISTIC;
+  } else {
+    return 1;
+  }
+  return 0;
+}
+
+int seatlocks_init(struct SeatLocks* seatlocks, enum SeatLockMode mode, size_t rows, size_t cols) {
+  size_t num_seats = rows * cols;
+
+  seatlocks->mode = mode;
+  seatlocks->cols = cols;
+  seatlocks->locks = NULL;
+  seatlocks->bits = NULL;
+
+  switch (mode) {
+    case SEAT_LOCK_SEAT:
+      seatlocks->count = num_seats;
+      break;
+    case SEAT_LOCK_ROW:
+      seatlocks->count = rows;
+      break;
+    case SEAT_LOCK_STRIPED:
+      seatlocks->count = num_seats < SEAT_LOCK_STRIPES ? num_seats : SEAT_LOCK_STRIPES;
+      break;
+    case SEAT_LOCK_BIT:
+      seatlocks->count = num_seats;
+      seatlocks->bits = state_calloc((num_seats + SEAT_LOCK_BITS - 1) / SEAT_LOCK_BITS, sizeof(atomic_ulong));
+      return seatlocks->bits == NULL && num_seats > 0;
+    case SEAT_LOCK_OPTIMISTIC:
+      seatlocks->count = 0;
+      return 0;
+  }
+
+  seatlocks->locks = state_alloc(seatlocks->count * sizeof(pthread_rwlock_t));
+  if (seatlocks->locks == NULL && seatlocks->count > 0) {
+    return 1;
+  }
+  for (size_t i = 0; i < seatlocks->count; i++) {
+    if (state_rwlock_init(&seatlocks->locks[i])) {
+      fprintf(stderr, "Lock Error\n");
+      exit(1);
+    }
+  }
+  return 0;
+}
+
+void seatlocks_destroy(struct SeatLocks* seatlocks) {
+  if (seatlocks->locks != NULL) {
+    for (size_t i = 0; i < seatlocks->count; i++) {
+      if (pthread_rwlock_destroy(&seatlocks->locks[i])) {
+        fprintf(stderr, "Lock Error\n");
+        exit(1);
+      }
+    }
+  }
+  state_free(seatlocks->locks);
+  state_free(seatlocks->bits);
+}
+
+size_t seatlock_id(struct SeatLocks const* seatlocks, size_t index) {
+  switch (seatlocks->mode) {
+    case SEAT_LOCK_ROW:
+      return index / seatlocks->cols;
+    case SEAT_LOCK_STRIPED:
+      return index % seatlocks->count;
+    case SEAT_LOCK_SEAT:
+    case SEAT_LOCK_BIT:
+    case SEAT_LOCK_OPTIMISTIC:
+      break;
+  }
+  return index;
+}
+
+static int compare_ids(const void* a, const void* b) {
+  size_t x = *(size_t const*)a;
+  size_t y = *(size_t const*)b;
+  return (x > y) - (x < y);
+}
+
+size_t seatlock_ids(struct SeatLocks const* seatlocks, size_t const* indexes, size_t num_seats, size_t* lock_ids) {
+  for (size_t i = 0; i < num_seats; i++) {
+    lock_ids[i] = seatlock_id(seatlocks, indexes[i]);
+  }
+  // Lock ids only follow the seat order when they don't wrap around
+  if (seatlocks->mode == SEAT_LOCK_STRIPED) {
+    qsort(lock_ids, num_seats, sizeof(size_t), compare_ids);
+  }
+
+  size_t count = 0;
+  for (size_t i = 0; i < num_seats; i++) {
+    if (count == 0 || lock_ids[count - 1] != lock_ids[i]) {
+      lock_ids[count++] = lock_ids[i];
+    }
+  }
+  return count;
+}
+
+/// Lock bit a waiter is parked for.
+struct HeldBit {
+  atomic_ulong* word;
+  unsigned long bit;
+};
+
+/// Checks whether a lock bit is still held, see park.
+static int bit_held(void const* arg) {
+  struct HeldBit const* held = arg;
+  return (atomic_load(held->word) & held->bit) != 0;
+}
+
+/// Acquires the spinlock bit of a seat.
+static void lock_bit(struct SeatLocks* seatlocks, size_t lock_id) {
+  struct HeldBit held = {&seatlocks->bits[lock_id / SEAT_LOCK_BITS], 1UL << (lock_id % SEAT_LOCK_BITS)};
+
+  while (atomic_fetch_or_explicit(held.word, held.bit, memory_order_acquire) & held.bit) {
+    // Holders may sleep through the state access delay, so waiters park until the bit is released
+    // rather than spin on it
+    park(held.word, bit_held, &held);
+  }
+}
+
+void seatlock_wrlock(struct SeatLocks* seatlocks, size_t lock_id) {
+  INSTRUMENT_SCOPE(INSTR_SEAT_LOCK);
+  if (seatlocks->mode == SEAT_LOCK_BIT) {
+    lock_bit(seatlocks, lock_id);
+    return;
+  }
+  if (fiber_running()) {
+    // The holder may be another fiber of this thread, which only runs once this one yields
+    int result;
+    while ((result = pthread_rwlock_trywrlock(&seatlocks->locks[lock_id])) == EBUSY) {
+      fiber_yield();
+    }
+    if (result) {
+      fprintf(stderr, "Lock Error\n");
+      exit(1);
+    }
+    return;
+  }
+  if (pthread_rwlock_wrlock(&seatlocks->locks[lock_id])) {
+    fprintf(stderr, "Lock Error\n");
+    exit(1);
+  }
+}
+
+void seatlock_unlock(struct SeatLocks* seatlocks, size_t lock_id) {
+  if (seatlocks->mode == SEAT_LOCK_BIT) {
+    atomic_ulong* word = &seatlocks->bits[lock_id / SEAT_LOCK_BITS];
+    atomic_fetch_and_explicit(word, ~(1UL << (lock_id % SEAT_LOCK_BITS)), memory_order_release);
+    unpark(word);
+    return;
+  }
+  if (pthread_rwlock_unlock(&seatlocks->locks[lock_id])) {
+    fprintf(stderr, "Lock Error\n");
+    exit(1);
+  }
+}
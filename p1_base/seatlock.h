@@ -0,0 +1,64 @@
+#ifndef EMS_SEAT_LOCK_H
+#define EMS_SEAT_LOCK_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+enum SeatLockMode {
+  SEAT_LOCK_SEAT,     // One rwlock per seat
+  SEAT_LOCK_ROW,      // One rwlock per row
+  SEAT_LOCK_STRIPED,  // A fixed number of rwlocks shared by the seats hashed to them
+  SEAT_LOCK_BIT,      // One spinlock bit per seat, packed into atomic words
+  SEAT_LOCK_OPTIMISTIC  // No locks, seats are claimed with compare-and-swap
+};
+
+// Locks protecting the seats of an event.
+// Each seat is covered by exactly one lock, identified by seatlock_id.
+struct SeatLocks {
+  enum SeatLockMode mode;
+  size_t cols;              /// Number of columns of the event.
+  size_t count;             /// Number of locks.
+  pthread_rwlock_t* locks;  /// Array of count rwlocks, unused in SEAT_LOCK_BIT and SEAT_LOCK_OPTIMISTIC modes.
+  atomic_ulong* bits;       /// Array of lock bits, only used in SEAT_LOCK_BIT mode.
+};
+
+/// Parses the name of a seat lock mode.
+/// @param name Name of the mode: "seat", "row", "striped", "bit" or "optimistic".
+/// @param mode Pointer to the variable to store the mode in.
+/// @return 0 if the name was parsed successfully, 1 otherwise.
+int parse_seat_lock_mode(const char* name, enum SeatLockMode* mode);
+
+/// Initializes the locks of an event.
+/// @param seatlocks Locks to be initialized.
+/// @param mode Lock granularity.
+/// @param rows Number of rows of the event.
+/// @param cols Number of columns of the event.
+/// @return 0 if the locks were initialized successfully, 1 otherwise.
+int seatlocks_init(struct SeatLocks* seatlocks, enum SeatLockMode mode, size_t rows, size_t cols);
+
+/// Destroys the locks of an event.
+/// @param seatlocks Locks to be destroyed.
+void seatlocks_destroy(struct SeatLocks* seatlocks);
+
+/// Gets the lock that covers a seat.
+/// @param seatlocks Locks of the event.
+/// @param index Index of the seat.
+/// @return Id of the lock.
+size_t seatlock_id(struct SeatLocks const* seatlocks, size_t index);
+
+/// Gets the locks that cover a set of seats, in the order they must be acquired.
+/// @param seatlocks Locks of the event.
+/// @param indexes Array of seat indexes sorted in ascending order.
+/// @param num_seats Number of seats.
+/// @param lock_ids Array of at least num_seats elements to store the lock ids in.
+/// @return Number of distinct lock ids stored, in ascending order.
+size_t seatlock_ids(struct SeatLocks const* seatlocks, size_t const* indexes, size_t num_seats, size_t* lock_ids);
+
+/// Acquires a lock for writing.
+void seatlock_wrlock(struct SeatLocks* seatlocks, size_t lock_id);
+
+/// Releases a lock.
+void seatlock_unlock(struct SeatLocks* seatlocks, size_t lock_id);
+
+#endif  // EMS_SEAT_LOCK_H
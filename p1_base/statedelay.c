@@ -0,0 +1,83 @@
+#include "statedelay.h"
+
+#include <errno.h>
+#include <time.h>
+
+#include "fiber.h"
+
+static unsigned long long delay_ns = 0;
+static unsigned long max_depth = 1;
+static _Thread_local struct DelayQueue thread_queue;
+
+/// Gets the accesses in flight of the caller, those of its fiber if it runs on one.
+static struct DelayQueue* current_queue() {
+  struct DelayQueue* queue = fiber_delay_queue();
+  return queue != NULL ? queue : &thread_queue;
+}
+
+static unsigned long long monotonic_ns() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec;
+}
+
+/// Sleeps until a point of the monotonic clock, letting the other fibers of the thread run meanwhile.
+static void sleep_until(unsigned long long deadline) {
+  if (fiber_running()) {
+    fiber_sleep_until(deadline);
+    return;
+  }
+  struct timespec until = {(time_t)(deadline / 1000000000ULL), (long)(deadline % 1000000000ULL)};
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR) {
+  }
+}
+
+void state_delay_init(unsigned int delay_us, unsigned int depth) {
+  delay_ns = (unsigned long long)delay_us * 1000ULL;
+  max_depth = depth == 0 ? 1 : depth > STATE_DELAY_MAX_DEPTH ? STATE_DELAY_MAX_DEPTH : depth;
+}
+
+/// Drops the accesses that have completed from a queue.
+/// @param now Current time of the monotonic clock.
+static void retire_completed(struct DelayQueue* queue, unsigned long long now) {
+  while (queue->oldest < queue->next && queue->deadlines[queue->oldest % STATE_DELAY_MAX_DEPTH] <= now) {
+    queue->oldest++;
+  }
+}
+
+int state_delay_can_issue() {
+  if (delay_ns == 0) {
+    return 1;
+  }
+  struct DelayQueue* queue = current_queue();
+  retire_completed(queue, monotonic_ns());
+  return queue->next - queue->oldest < max_depth;
+}
+
+unsigned long state_delay_issue() {
+  struct DelayQueue* queue = current_queue();
+  if (delay_ns == 0) {
+    return queue->next++;
+  }
+
+  unsigned long long now = monotonic_ns();
+  retire_completed(queue, now);
+  if (queue->next - queue->oldest == max_depth) {
+    sleep_until(queue->deadlines[queue->oldest % STATE_DELAY_MAX_DEPTH]);
+    queue->oldest++;
+    now = monotonic_ns();
+  }
+  queue->deadlines[queue->next % STATE_DELAY_MAX_DEPTH] = now + delay_ns;
+  return queue->next++;
+}
+
+void state_delay_wait(unsigned long ticket) {
+  struct DelayQueue* queue = current_queue();
+  // Accesses older than the queue have completed already
+  if (delay_ns == 0 || ticket < queue->oldest || ticket >= queue->next) {
+    return;
+  }
+  sleep_until(queue->deadlines[ticket % STATE_DELAY_MAX_DEPTH]);  // Should not be removed
+}
+
+void state_delay_access() { state_delay_wait(state_delay_issue()); }
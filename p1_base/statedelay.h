@@ -0,0 +1,42 @@
+#ifndef EMS_STATE_DELAY_H
+#define EMS_STATE_DELAY_H
+
+/// Simulated latency of the costly memory the EMS state lives in.
+/// @note Accesses are asynchronous: each one is issued and completes a delay later, and a thread may
+/// keep up to the access depth of them in flight, so the latency of accesses issued together overlaps.
+/// Depth 1 waits for each access before the next one is issued.
+
+#include "constants.h"
+
+/// Accesses in flight of a thread or fiber, completed in the order they were issued.
+struct DelayQueue {
+  unsigned long long deadlines[STATE_DELAY_MAX_DEPTH];  /// Completion time of each access, by ticket.
+  unsigned long oldest;                                  /// Ticket of the oldest access in flight.
+  unsigned long next;                                    /// Ticket of the next access.
+};
+
+/// Sets the latency model of every thread.
+/// @note Must be called before any access is issued.
+/// @param delay_us Delay of each access in microseconds, 0 for none.
+/// @param depth Accesses a thread keeps in flight at once, up to STATE_DELAY_MAX_DEPTH.
+void state_delay_init(unsigned int delay_us, unsigned int depth);
+
+/// Issues an access to the state.
+/// @note Accesses are tracked per fiber when running on one (see fiber.h), per thread otherwise. Waits
+/// for the oldest access of the caller first if its depth is in flight already.
+/// @return Ticket of the access, to be waited for with state_delay_wait. Tickets of the accesses
+/// issued by a thread or fiber are consecutive.
+unsigned long state_delay_issue();
+
+/// Checks whether an access can be issued without waiting for an earlier one.
+/// @return 1 if fewer than the access depth of accesses of the calling thread are in flight, 0 otherwise.
+int state_delay_can_issue();
+
+/// Waits for an access issued by the calling thread to complete.
+/// @param ticket Ticket of the access.
+void state_delay_wait(unsigned long ticket);
+
+/// Issues an access to the state and waits for it to complete.
+void state_delay_access();
+
+#endif  // EMS_STATE_DELAY_H
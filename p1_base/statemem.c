@@ -0,0 +1,129 @@
+#include "statemem.h"
+
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "constants.h"
+
+#define STATEMEM_ALIGNMENT CACHE_LINE_SIZE  // Allocations start on their own cache line
+
+/// Header at the start of the shared memory region.
+struct SharedRegion {
+  size_t size;          /// Size of the region, header included.
+  atomic_size_t used;   /// Bytes allocated so far, header included.
+  pid_t owner;          /// Process that mapped the region.
+};
+
+static struct SharedRegion* region = NULL;
+
+int statemem_share(size_t size) {
+  if (region != NULL || size < sizeof(struct SharedRegion)) {
+    return 1;
+  }
+
+  // The name is only needed to create the object: it's unlinked right away, children reach the
+  // region through the inherited mapping and it is released with the last process
+  char name[32];
+  snprintf(name, sizeof(name), "/ems-%ld", (long)getpid());
+  int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+  if (fd == -1) {
+    return 1;
+  }
+  shm_unlink(name);
+  if (ftruncate(fd, (off_t)size)) {
+    close(fd);
+    return 1;
+  }
+  void* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return 1;
+  }
+
+  region = mapping;
+  region->size = size;
+  size_t header = (sizeof(struct SharedRegion) + STATEMEM_ALIGNMENT - 1) & ~(size_t)(STATEMEM_ALIGNMENT - 1);
+  atomic_init(&region->used, header);
+  region->owner = getpid();
+  return 0;
+}
+
+void statemem_unshare() {
+  if (region != NULL) {
+    munmap(region, region->size);
+    region = NULL;
+  }
+}
+
+int statemem_shared() { return region != NULL; }
+
+int statemem_owner() { return region != NULL && region->owner == getpid(); }
+
+void* state_alloc(size_t size) {
+  if (region == NULL) {
+    return malloc(size);
+  }
+
+  size_t rounded = (size + STATEMEM_ALIGNMENT - 1) & ~(size_t)(STATEMEM_ALIGNMENT - 1);
+  size_t offset = atomic_fetch_add(&region->used, rounded);
+  if (offset + rounded > region->size) {
+    fprintf(stderr, "Shared memory region is full\n");
+    return NULL;
+  }
+  return (char*)region + offset;
+}
+
+void* state_calloc(size_t count, size_t size) {
+  if (region == NULL) {
+    return calloc(count, size);
+  }
+  if (size != 0 && count > (size_t)-1 / size) {
+    return NULL;
+  }
+  // The region is zero-filled by ftruncate and never reused, so its memory is already zeroed
+  return state_alloc(count * size);
+}
+
+void state_free(void* ptr) {
+  if (region == NULL) {
+    free(ptr);
+  }
+}
+
+int state_mutex_init(pthread_mutex_t* mutex) {
+  pthread_mutexattr_t attr;
+  if (pthread_mutexattr_init(&attr)) {
+    return 1;
+  }
+  int result = pthread_mutexattr_setpshared(&attr, region != NULL ? PTHREAD_PROCESS_SHARED : PTHREAD_PROCESS_PRIVATE) ||
+               pthread_mutex_init(mutex, &attr);
+  pthread_mutexattr_destroy(&attr);
+  return result;
+}
+
+int state_rwlock_init(pthread_rwlock_t* rwlock) {
+  pthread_rwlockattr_t attr;
+  if (pthread_rwlockattr_init(&attr)) {
+    return 1;
+  }
+  int result = pthread_rwlockattr_setpshared(&attr, region != NULL ? PTHREAD_PROCESS_SHARED : PTHREAD_PROCESS_PRIVATE) ||
+               pthread_rwlock_init(rwlock, &attr);
+  pthread_rwlockattr_destroy(&attr);
+  return result;
+}
+
+int state_cond_init(pthread_cond_t* cond) {
+  pthread_condattr_t attr;
+  if (pthread_condattr_init(&attr)) {
+    return 1;
+  }
+  int result = pthread_condattr_setpshared(&attr, region != NULL ? PTHREAD_PROCESS_SHARED : PTHREAD_PROCESS_PRIVATE) ||
+               pthread_cond_init(cond, &attr);
+  pthread_condattr_destroy(&attr);
+  return result;
+}
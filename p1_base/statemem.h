@@ -0,0 +1,51 @@
+#ifndef EMS_STATE_MEMORY_H
+#define EMS_STATE_MEMORY_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+/// Maps the shared memory region the EMS state is allocated from in shared mode.
+/// @note Must be called before forking: children inherit the mapping at the same address, so pointers
+/// stored in the region are valid in every process.
+/// @param size Size of the region in bytes.
+/// @return 0 if the region was mapped successfully, 1 otherwise.
+int statemem_share(size_t size);
+
+/// Unmaps the shared memory region, if there is one.
+void statemem_unshare();
+
+/// Checks whether the EMS state is allocated from the shared memory region.
+/// @return 1 in shared mode, 0 otherwise.
+int statemem_shared();
+
+/// Checks whether the calling process mapped the shared memory region.
+/// @note Only that process may destroy the state in the region, the others are still using it.
+/// @return 1 if it did, 0 otherwise.
+int statemem_owner();
+
+/// Allocates memory for the EMS state.
+/// @note In shared mode, memory is taken from the shared region and only given back when the region is
+/// unmapped.
+/// @param size Number of bytes.
+/// @return Pointer to the memory, NULL if there is not enough.
+void* state_alloc(size_t size);
+
+/// Allocates zeroed memory for the EMS state, see state_alloc.
+void* state_calloc(size_t count, size_t size);
+
+/// Frees memory allocated by state_alloc or state_calloc.
+void state_free(void* ptr);
+
+/// Initializes a mutex stored in the EMS state, shared between processes in shared mode.
+/// @return 0 if the mutex was initialized successfully, 1 otherwise.
+int state_mutex_init(pthread_mutex_t* mutex);
+
+/// Initializes a rwlock stored in the EMS state, shared between processes in shared mode.
+/// @return 0 if the rwlock was initialized successfully, 1 otherwise.
+int state_rwlock_init(pthread_rwlock_t* rwlock);
+
+/// Initializes a condition variable stored in the EMS state, shared between processes in shared mode.
+/// @return 0 if the condition variable was initialized successfully, 1 otherwise.
+int state_cond_init(pthread_cond_t* cond);
+
+#endif  // EMS_STATE_MEMORY_H
@@ -0,0 +1,216 @@
+#include "store.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "constants.h"
+
+#define STORE_MAGIC "EMSSTORE"
+#define STORE_VERSION 1
+
+struct StoreHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t used;      /// Bytes taken by the header and the records.
+  uint64_t checksum;  /// Checksum of the fields above.
+};
+
+struct StoreRecord {
+  uint32_t id;
+  uint32_t committed;  /// 1 once the event exists, records of failed CREATEs stay at 0.
+  uint64_t rows;
+  uint64_t cols;
+  uint64_t checksum;   /// Checksum of id, rows and cols.
+  atomic_uint seats[];
+};
+
+static int store_fd = -1;
+static char* mapping = NULL;  // Window of STORE_WINDOW_SIZE bytes, of which the file covers file_size
+static size_t file_size = 0;
+static pthread_mutex_t store_lock = PTHREAD_MUTEX_INITIALIZER;  // Serializes the additions of events
+
+/// Hashes a range of bytes with 64-bit FNV-1a.
+static uint64_t checksum(void const* data, size_t size, uint64_t hash) {
+  unsigned char const* bytes = data;
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+static uint64_t header_checksum(struct StoreHeader const* header) {
+  return checksum(header, offsetof(struct StoreHeader, checksum), 0xcbf29ce484222325ULL);
+}
+
+static uint64_t record_checksum(struct StoreRecord const* record) {
+  uint64_t hash = checksum(&record->id, sizeof(record->id), 0xcbf29ce484222325ULL);
+  hash = checksum(&record->rows, sizeof(record->rows), hash);
+  return checksum(&record->cols, sizeof(record->cols), hash);
+}
+
+/// Gets the size of the record of an event, keeping the records that follow it aligned.
+/// @return Size in bytes, 0 if the event is too large for the store.
+static size_t record_size(uint64_t rows, uint64_t cols) {
+  if (cols != 0 && rows > STORE_WINDOW_SIZE / cols) {
+    return 0;
+  }
+  size_t size = sizeof(struct StoreRecord) + (size_t)(rows * cols) * sizeof(atomic_uint);
+  return (size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+}
+
+/// Grows the file so that it covers at least the given size of the window.
+/// @return 0 if the file covers it, 1 otherwise.
+static int grow_file(size_t size) {
+  if (size <= file_size) {
+    return 0;
+  }
+  if (size > STORE_WINDOW_SIZE) {
+    return 1;
+  }
+  size_t new_size = file_size * 2 > size ? file_size * 2 : size;
+  new_size = new_size < STORE_WINDOW_SIZE ? new_size : STORE_WINDOW_SIZE;
+  if (ftruncate(store_fd, (off_t)new_size)) {
+    return 1;
+  }
+  file_size = new_size;
+  return 0;
+}
+
+/// Checks the header and the records of a store that was just mapped.
+/// @return 0 if the store is valid, 1 otherwise.
+static int validate_store() {
+  struct StoreHeader* header = (struct StoreHeader*)mapping;
+  if (memcmp(header->magic, STORE_MAGIC, sizeof(header->magic)) != 0 || header->version != STORE_VERSION ||
+      header->checksum != header_checksum(header) || header->used > file_size) {
+    return 1;
+  }
+  for (size_t offset = sizeof(struct StoreHeader); offset < header->used;) {
+    struct StoreRecord* record = (struct StoreRecord*)(mapping + offset);
+    size_t size;
+    if (header->used - offset < sizeof(struct StoreRecord) || record->checksum != record_checksum(record) ||
+        (size = record_size(record->rows, record->cols)) == 0 || size > header->used - offset) {
+      return 1;
+    }
+    offset += size;
+  }
+  return 0;
+}
+
+int store_open(const char* path) {
+  if (store_fd != -1) {
+    return 1;
+  }
+  store_fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+  if (store_fd == -1) {
+    return 1;
+  }
+  struct stat st;
+  if (fstat(store_fd, &st)) {
+    store_close();
+    return 1;
+  }
+  file_size = (size_t)st.st_size;
+
+  // The whole window is reserved up front, so seats never move while the file grows under it
+  mapping = mmap(NULL, STORE_WINDOW_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, store_fd, 0);
+  if (mapping == MAP_FAILED) {
+    mapping = NULL;
+    store_close();
+    return 1;
+  }
+
+  if (file_size == 0) {
+    if (grow_file(STORE_INITIAL_SIZE)) {
+      store_close();
+      return 1;
+    }
+    struct StoreHeader* header = (struct StoreHeader*)mapping;
+    memcpy(header->magic, STORE_MAGIC, sizeof(header->magic));
+    header->version = STORE_VERSION;
+    header->used = sizeof(struct StoreHeader);
+    header->checksum = header_checksum(header);
+  }
+  else if (file_size < sizeof(struct StoreHeader) || file_size > STORE_WINDOW_SIZE || validate_store()) {
+    fprintf(stderr, "Invalid or corrupted store\n");
+    store_close();
+    return 1;
+  }
+  return 0;
+}
+
+void store_close() {
+  if (mapping != NULL) {
+    msync(mapping, file_size, MS_SYNC);
+    munmap(mapping, STORE_WINDOW_SIZE);
+    mapping = NULL;
+  }
+  if (store_fd != -1) {
+    close(store_fd);
+    store_fd = -1;
+  }
+  file_size = 0;
+}
+
+int store_enabled() { return mapping != NULL; }
+
+atomic_uint* store_next_event(size_t* offset, unsigned int* event_id, size_t* rows, size_t* cols) {
+  struct StoreHeader* header = (struct StoreHeader*)mapping;
+  if (*offset == 0) {
+    *offset = sizeof(struct StoreHeader);
+  }
+  while (*offset < header->used) {
+    struct StoreRecord* record = (struct StoreRecord*)(mapping + *offset);
+    *offset += record_size(record->rows, record->cols);
+    if (record->committed) {
+      *event_id = record->id;
+      *rows = (size_t)record->rows;
+      *cols = (size_t)record->cols;
+      return record->seats;
+    }
+  }
+  return NULL;
+}
+
+atomic_uint* store_add_event(unsigned int event_id, size_t rows, size_t cols) {
+  size_t size = record_size(rows, cols);
+  if (size == 0) {
+    return NULL;
+  }
+
+  if (pthread_mutex_lock(&store_lock)) {
+    fprintf(stderr, "Lock Error\n");
+    exit(1);
+  }
+  struct StoreHeader* header = (struct StoreHeader*)mapping;
+  size_t offset = (size_t)header->used;
+  struct StoreRecord* record = NULL;
+  if (size <= STORE_WINDOW_SIZE - offset && grow_file(offset + size) == 0) {
+    // The file only grows and records are never reused, so the seats are still zeroed
+    record = (struct StoreRecord*)(mapping + offset);
+    record->id = event_id;
+    record->committed = 0;
+    record->rows = rows;
+    record->cols = cols;
+    record->checksum = record_checksum(record);
+    header->used = offset + size;
+    header->checksum = header_checksum(header);
+  }
+  if (pthread_mutex_unlock(&store_lock)) {
+    fprintf(stderr, "Lock Error\n");
+    exit(1);
+  }
+  return record != NULL ? record->seats : NULL;
+}
+
+void store_commit_event(atomic_uint* seats) {
+  struct StoreRecord* record = (struct StoreRecord*)((char*)seats - offsetof(struct StoreRecord, seats));
+  record->committed = 1;
+}
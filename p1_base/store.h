@@ -0,0 +1,46 @@
+#ifndef EMS_STORE_H
+#define EMS_STORE_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+// Persistent event store: a file holding a header followed by one record per event, each record being
+// the dimensions of the event followed by its seats. The file is mapped into memory, so reservations
+// update the seats in place and reopening it only rebuilds the index of the events.
+// Reservations are kept whole if the process dies: seats are marked before being written and reopening
+// the store finishes or undoes what was marked. The mapping is only synced by store_close though, so
+// only the log (see wal.h) keeps reservations across a crash of the system.
+
+/// Opens the store, creating it if the file doesn't exist.
+/// @param path Path of the store file.
+/// @return 0 if the store was opened successfully, 1 if it could not be opened or is not a valid store.
+int store_open(const char* path);
+
+/// Writes the store back to its file and closes it.
+void store_close();
+
+/// Checks whether a store is open.
+/// @return 1 if it is, 0 otherwise.
+int store_enabled();
+
+/// Gets the next event of the store.
+/// @param offset Pointer to the position of the iteration, 0 to start from the first event.
+/// @param event_id Pointer to the variable to store the id of the event in.
+/// @param rows Pointer to the variable to store the number of rows in.
+/// @param cols Pointer to the variable to store the number of columns in.
+/// @return Seats of the event, NULL after the last event.
+atomic_uint* store_next_event(size_t* offset, unsigned int* event_id, size_t* rows, size_t* cols);
+
+/// Adds an event to the store, with every seat free.
+/// @note The event is only kept by the store once committed with store_commit_event.
+/// @param event_id Id of the event.
+/// @param rows Number of rows.
+/// @param cols Number of columns.
+/// @return Seats of the event, NULL if the store could not grow.
+atomic_uint* store_add_event(unsigned int event_id, size_t rows, size_t cols);
+
+/// Commits an event added to the store.
+/// @param seats Seats of the event, as returned by store_add_event.
+void store_commit_event(atomic_uint* seats);
+
+#endif  // EMS_STORE_H
@@ -0,0 +1,272 @@
+#include "wal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "fiber.h"
+#include "instrument.h"
+
+/// Header of a record in the log file.
+struct WalRecord {
+  uint32_t size;      /// Bytes of the record, header included.
+  uint32_t checksum;  /// Checksum of the rest of the record.
+  uint32_t type;
+  uint32_t event_id;
+  uint64_t arg0;      /// Number of rows, or id of the reservation.
+  uint64_t arg1;      /// Number of columns, or number of seats.
+  uint64_t seats[];   /// Seat indexes of a reservation.
+};
+
+/// Records appended and not yet written.
+struct WalBuffer {
+  char* data;
+  size_t len;
+  size_t capacity;
+};
+
+static int wal_fd = -1;
+static pthread_mutex_t wal_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wal_synced = PTHREAD_COND_INITIALIZER;  // Signaled when a group is durable
+static struct WalBuffer buffers[2];   // One takes records while the group in the other is written
+static struct WalBuffer* pending = &buffers[0];
+static unsigned long appended_lsn = 0;
+static unsigned long durable_lsn = 0;
+static int syncing = 0;               // Whether a thread is writing a group
+
+static void lock_wal() {
+  if (pthread_mutex_lock(&wal_lock)) {
+    fprintf(stderr, "Lock Error\n");
+    exit(1);
+  }
+}
+
+static void unlock_wal() {
+  if (pthread_mutex_unlock(&wal_lock)) {
+    fprintf(stderr, "Lock Error\n");
+    exit(1);
+  }
+}
+
+/// Hashes the part of a record covered by its checksum with 32-bit FNV-1a.
+static uint32_t record_checksum(struct WalRecord const* record) {
+  unsigned char const* bytes = (unsigned char const*)record;
+  uint32_t hash = 0x811c9dc5U;
+  for (size_t i = offsetof(struct WalRecord, type); i < record->size; i++) {
+    hash = (hash ^ bytes[i]) * 0x01000193U;
+  }
+  return hash;
+}
+
+/// Writes a whole buffer to the log file.
+static void write_all(char const* data, size_t len) {
+  while (len > 0) {
+    ssize_t written = write(wal_fd, data, len);
+    if (written == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "Error writing to the log\n");
+      exit(1);
+    }
+    data += written;
+    len -= (size_t)written;
+  }
+}
+
+int wal_open(const char* path) {
+  if (wal_fd != -1) {
+    return 1;
+  }
+  wal_fd = open(path, O_RDWR | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR);
+  return wal_fd == -1;
+}
+
+void wal_close() {
+  if (wal_fd != -1) {
+    close(wal_fd);
+    wal_fd = -1;
+  }
+  free(buffers[0].data);
+  free(buffers[1].data);
+  memset(buffers, 0, sizeof(buffers));
+}
+
+int wal_enabled() { return wal_fd != -1; }
+
+int wal_replay(void (*apply)(struct WalEntry const* entry, void* arg), void* arg) {
+  struct stat st;
+  if (fstat(wal_fd, &st)) {
+    return 1;
+  }
+  size_t size = (size_t)st.st_size;
+  char* log = malloc(size > 0 ? size : 1);
+  if (log == NULL) {
+    return 1;
+  }
+  for (size_t done = 0; done < size;) {
+    ssize_t count = pread(wal_fd, log + done, size - done, (off_t)done);
+    if (count <= 0) {
+      if (count == -1 && errno == EINTR) {
+        continue;
+      }
+      free(log);
+      return 1;
+    }
+    done += (size_t)count;
+  }
+
+  size_t offset = 0;
+  while (offset < size) {
+    struct WalRecord* record = (struct WalRecord*)(log + offset);
+    if (size - offset < sizeof(struct WalRecord) || record->size < sizeof(struct WalRecord) ||
+        record->size > size - offset || record->checksum != record_checksum(record)) {
+      break;
+    }
+    struct WalEntry entry = {.type = (enum WalType)record->type, .event_id = record->event_id};
+    if (record->type == WAL_CREATE) {
+      entry.rows = (size_t)record->arg0;
+      entry.cols = (size_t)record->arg1;
+      apply(&entry, arg);
+    }
+    else if (record->type == WAL_RESERVE &&
+             record->arg1 == (record->size - sizeof(struct WalRecord)) / sizeof(uint64_t)) {
+      entry.reservation_id = (unsigned int)record->arg0;
+      entry.num_seats = (size_t)record->arg1;
+      entry.seats = record->seats;
+      apply(&entry, arg);
+    }
+    offset += record->size;
+  }
+  free(log);
+
+  if (offset < size) {
+    fprintf(stderr, "Discarding %zu bytes of torn records at the end of the log\n", size - offset);
+    if (ftruncate(wal_fd, (off_t)offset)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+void wal_truncate() {
+  lock_wal();
+  if (ftruncate(wal_fd, 0) || fdatasync(wal_fd)) {
+    fprintf(stderr, "Error truncating the log\n");
+    exit(1);
+  }
+  unlock_wal();
+}
+
+/// Appends a record to the pending buffer.
+/// @note Must be called with the log lock held.
+/// @param type Type of the record.
+/// @param event_id Id of the event.
+/// @param arg0 First argument of the record.
+/// @param arg1 Second argument of the record.
+/// @param num_seats Number of seat indexes that follow the header.
+/// @return The record, to be filled with the seat indexes and sealed by seal_record.
+static struct WalRecord* append_record(enum WalType type, unsigned int event_id, uint64_t arg0, uint64_t arg1,
+                                       size_t num_seats) {
+  size_t size = sizeof(struct WalRecord) + num_seats * sizeof(uint64_t);
+  if (pending->len + size > pending->capacity) {
+    size_t capacity = pending->capacity > 0 ? pending->capacity : WAL_BUFFER_SIZE;
+    while (capacity < pending->len + size) {
+      capacity *= 2;
+    }
+    char* data = realloc(pending->data, capacity);
+    if (data == NULL) {
+      fprintf(stderr, "Error allocating memory for the log\n");
+      exit(1);
+    }
+    pending->data = data;
+    pending->capacity = capacity;
+  }
+
+  struct WalRecord* record = (struct WalRecord*)(pending->data + pending->len);
+  pending->len += size;
+  record->size = (uint32_t)size;
+  record->type = (uint32_t)type;
+  record->event_id = event_id;
+  record->arg0 = arg0;
+  record->arg1 = arg1;
+  return record;
+}
+
+/// Computes the checksum of a filled record and gives it a sequence number.
+/// @note Must be called with the log lock held.
+static unsigned long seal_record(struct WalRecord* record) {
+  record->checksum = record_checksum(record);
+  return ++appended_lsn;
+}
+
+unsigned long wal_log_create(unsigned int event_id, size_t rows, size_t cols) {
+  lock_wal();
+  unsigned long lsn = seal_record(append_record(WAL_CREATE, event_id, rows, cols, 0));
+  unlock_wal();
+  return lsn;
+}
+
+unsigned long wal_log_reserve(unsigned int event_id, unsigned int reservation_id, size_t const* seats, size_t num_seats) {
+  lock_wal();
+  struct WalRecord* record = append_record(WAL_RESERVE, event_id, reservation_id, num_seats, num_seats);
+  for (size_t i = 0; i < num_seats; i++) {
+    record->seats[i] = seats[i];
+  }
+  unsigned long lsn = seal_record(record);
+  unlock_wal();
+  return lsn;
+}
+
+void wal_wait(unsigned long lsn) {
+  INSTRUMENT_SCOPE(INSTR_WAL_WAIT);
+  int gathered = 0;
+  lock_wal();
+  while (durable_lsn < lsn) {
+    if (fiber_running() && (syncing || !gathered)) {
+      // A fiber lets the other fibers of its thread run instead of blocking it on the group being
+      // written, and before leading one it lets them append their records to it first
+      gathered = 1;
+      unlock_wal();
+      fiber_yield();
+      lock_wal();
+      continue;
+    }
+    if (syncing) {
+      if (pthread_cond_wait(&wal_synced, &wal_lock)) {
+        fprintf(stderr, "Lock Error\n");
+        exit(1);
+      }
+      continue;
+    }
+
+    // Lead the next group: everything appended so far, including records of threads still waiting
+    struct WalBuffer* group = pending;
+    unsigned long group_lsn = appended_lsn;
+    pending = group == &buffers[0] ? &buffers[1] : &buffers[0];
+    syncing = 1;
+    unlock_wal();
+
+    write_all(group->data, group->len);
+    if (fdatasync(wal_fd)) {
+      fprintf(stderr, "Error syncing the log\n");
+      exit(1);
+    }
+    group->len = 0;
+
+    lock_wal();
+    durable_lsn = group_lsn;
+    syncing = 0;
+    if (pthread_cond_broadcast(&wal_synced)) {
+      fprintf(stderr, "Lock Error\n");
+      exit(1);
+    }
+  }
+  unlock_wal();
+}
@@ -0,0 +1,68 @@
+#ifndef EMS_WAL_H
+#define EMS_WAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Write-ahead log of the CREATEs and reservations, replayed when the EMS starts. Records are appended
+// to an in-memory buffer and made durable in groups: the first thread that needs its record on disk
+// writes and syncs everything appended so far, while the others wait for it and only sync themselves
+// if their record came too late for that group.
+
+enum WalType {
+  WAL_CREATE = 1,
+  WAL_RESERVE = 2,
+};
+
+/// Record of the log, as passed to the replay function.
+struct WalEntry {
+  enum WalType type;
+  unsigned int event_id;
+  size_t rows;                  /// Number of rows, for WAL_CREATE.
+  size_t cols;                  /// Number of columns, for WAL_CREATE.
+  unsigned int reservation_id;  /// Id of the reservation, for WAL_RESERVE.
+  size_t num_seats;             /// Number of seats, for WAL_RESERVE.
+  uint64_t const* seats;        /// Indexes of the seats, for WAL_RESERVE.
+};
+
+/// Opens the log, creating it if the file doesn't exist.
+/// @param path Path of the log file.
+/// @return 0 if the log was opened successfully, 1 otherwise.
+int wal_open(const char* path);
+
+/// Closes the log.
+void wal_close();
+
+/// Checks whether a log is open.
+/// @return 1 if it is, 0 otherwise.
+int wal_enabled();
+
+/// Replays the records of the log, in the order they were appended.
+/// @note A torn record at the end of the log, left by a crash, is cut off along with anything after it.
+/// @param apply Function called with each record and arg.
+/// @param arg Argument passed to apply.
+/// @return 0 if the log was replayed successfully, 1 otherwise.
+int wal_replay(void (*apply)(struct WalEntry const* entry, void* arg), void* arg);
+
+/// Empties the log, once everything in it has been persisted elsewhere.
+void wal_truncate();
+
+/// Appends the record of a CREATE.
+/// @return Sequence number of the record, to be passed to wal_wait.
+unsigned long wal_log_create(unsigned int event_id, size_t rows, size_t cols);
+
+/// Appends the record of a reservation.
+/// @param event_id Id of the event.
+/// @param reservation_id Id of the reservation.
+/// @param seats Array of seat indexes.
+/// @param num_seats Number of seats.
+/// @return Sequence number of the record, to be passed to wal_wait.
+unsigned long wal_log_reserve(unsigned int event_id, unsigned int reservation_id, size_t const* seats, size_t num_seats);
+
+/// Waits until a record and all the records before it are durable.
+/// @note On a fiber, the other fibers of the thread run while it waits for a group another thread
+/// writes. The thread that writes a group is blocked until it is synced, fibers included.
+/// @param lsn Sequence number of the record.
+void wal_wait(unsigned long lsn);
+
+#endif  // EMS_WAL_H